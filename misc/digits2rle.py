@@ -0,0 +1,71 @@
+#!/usr/bin/python
+#
+# Packs the digit tiles (resources/images/num_*_d.png) into run length
+# encoded glyphs drawn by src/digits.c. Hour and minute tiles only differ
+# in background, so only the shape is stored.
+#
+# Layout, little endian:
+#   uint8 glyph count, uint8 width, uint8 height, uint8 reserved
+#   uint16 offset of every glyph from the start of the glyph data
+#   glyph data: one byte per run, runs of a row add up to width.
+#   Run byte: 2 bit level (0 = background, 3 = white) and 6 bit length - 1.
+#
+# Run from this directory: python digits2rle.py
+
+import struct
+from PIL import Image
+
+INPUT_IMAGE_FILEPATH_TEMPLATE = "../resources/images/num_%d_d.png"
+OUTPUT_FILEPATH = "../resources/data/digits.rle"
+
+GLYPH_COUNT = 12
+MAX_RUN = 64
+
+
+def level(pixel):
+    return (pixel[0] * 3 + 127) // 255
+
+
+def encode(image):
+    width, height = image.size
+    runs = bytearray()
+
+    for y in range(height):
+        x = 0
+        while x < width:
+            lvl = level(image.getpixel((x, y)))
+            length = 1
+            while x + length < width and length < MAX_RUN and level(image.getpixel((x + length, y))) == lvl:
+                length += 1
+
+            runs.append((lvl << 6) | (length - 1))
+            x += length
+
+    return runs
+
+
+if __name__ == "__main__":
+    glyphs = []
+    size = None
+
+    for digit in range(0, GLYPH_COUNT):
+        image = Image.open(INPUT_IMAGE_FILEPATH_TEMPLATE % digit).convert("RGB")
+        if size is None:
+            size = image.size
+        assert image.size == size, "All tiles must have the same size"
+        glyphs.append(encode(image))
+
+    data = bytearray(struct.pack("<BBBB", GLYPH_COUNT, size[0], size[1], 0))
+
+    offset = 0
+    for glyph in glyphs:
+        data += struct.pack("<H", offset)
+        offset += len(glyph)
+
+    for glyph in glyphs:
+        data += glyph
+
+    with open(OUTPUT_FILEPATH, "wb") as f:
+        f.write(data)
+
+    print("%d glyphs %dx%d, %d bytes" % (GLYPH_COUNT, size[0], size[1], len(data)))
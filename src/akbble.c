@@ -1,9 +1,18 @@
 #include <pebble.h>
 #include "message-queue.h"
 #include "utils.h"
+#include "timeline.h"
+#include "profile.h"
+#include "snapshot.h"
+#include "startup.h"
+#include "forecast.h"
+#include "scheduler.h"
+#include "digits.h"
+#include "frame-snapshot.h"
 
 #define TOTAL_IMAGE_SLOTS 3
-#define NUMBER_OF_IMAGES 12
+#define DIGIT_WIDTH 48
+#define DIGIT_HEIGHT 67
 #define NUMBER_OF_WEATHER_ICONS 5
 
 #define SCR_WIDTH 144
@@ -11,21 +20,69 @@
 
 #define ANIM_DURATION 2000
 #define ANIM_DELAY 1000
+#define ANIM_DELAY_SLACK_MS 500
 #define ANIM_HEIGHT 25
+#define ANIM_FPS 25
+#define ANIM_BANDS 2
+
+// Last frame is saved once the display settles, it rides on the next minute
+// tick and is not saved more often than the interval to spare the flash
+#define FRAME_SNAPSHOT_SETTLE_MS 5000
+#define FRAME_SNAPSHOT_SETTLE_SLACK_MS 60000
+#define FRAME_SNAPSHOT_INTERVAL_SECS (10 * 60)
+
+// Double tap window, closing it a bit late is harmless
+#define TAP_WINDOW_MS 4000
+#define TAP_WINDOW_SLACK_MS 500
+
+// Data request older than this is useless, a new one will be issued anyway
+#define GET_DATA_TTL_SECS (5 * 60)
+
+// Diagnostics report is plain text, it goes out as a blob
+#define DIAGNOSTICS_MAX_LENGTH 256
+
+// Forecast blob: uint32 little endian epoch of the first hour, then packed hours
+#define FORECAST_BLOB_HEADER_SIZE 4
+
+// Undelivered data request is retried after this
+#define DATA_RETRY_SECS (5 * 60)
+
+// With a forecast we poll at most this often, but refetch before it runs out
+#define FORECAST_FETCH_INTERVAL_SECS (3 * 60 * 60)
+#define FORECAST_REFETCH_HOURS 3
 
 #define MASK_WATCHFACE_REQUEST_ALARM 1
 #define MASK_WATCHFACE_REQUEST_TEMP 2
 #define MASK_WATCHFACE_REQUEST_ALL (MASK_WATCHFACE_REQUEST_TEMP | MASK_WATCHFACE_REQUEST_ALARM)
 
+// Fields present in a data response
+#define MASK_DATA_ALARM 1
+#define MASK_DATA_TEMP 2
+#define MASK_DATA_COND 4
+#define MASK_DATA_HUM 8
+#define MASK_DATA_FORECAST 16
+#define MASK_DATA_VERSION 32
+#define MASK_DATA_ALL_VALUES (MASK_DATA_ALARM | MASK_DATA_TEMP | MASK_DATA_COND | MASK_DATA_HUM)
+
 enum {
     CMD_OUT_GET_DATA = 20,
     CMD_IN_GET_DATA_RESPONSE = 21,
+    CMD_IN_GET_DATA_NOT_MODIFIED = 22,
+    CMD_IN_GET_DIAGNOSTICS = 23,
+    CMD_OUT_DIAGNOSTICS = 24,                     // blob, text report
+    CMD_IN_FORECAST = 25,                         // blob, forecast series outside of a data response
 
     CMD_IN_GET_DATA_RESPONSE_ALARM_TIME = 30,
     CMD_IN_GET_DATA_RESPONSE_WEATHER_TEMP = 31,
     CMD_IN_GET_DATA_RESPONSE_WEATHER_COND = 32,
     CMD_IN_GET_DATA_RESPONSE_WEATHER_HUM = 33,
-    CMD_IN_GET_DATA_RESPONSE_WEATHER_WIND = 34
+    CMD_IN_GET_DATA_RESPONSE_WEATHER_WIND = 34,
+    CMD_IN_GET_DATA_RESPONSE_FORECAST_START = 35, // uint32, epoch of the first forecast hour
+    CMD_IN_GET_DATA_RESPONSE_FORECAST = 36,       // bytes, FORECAST_PACKED_ENTRY_SIZE per hour
+    CMD_IN_GET_DATA_RESPONSE_STATE_VERSION = 37,  // uint32, response only has fields changed since requested version
+
+    CMD_OUT_GET_DATA_FORECAST_HOURS = 40,
+    CMD_OUT_GET_DATA_STATE_VERSION = 41           // uint32, version of the state we hold, 0 = nothing
 };
 
 static const uint32_t WEATHER_ICONS[NUMBER_OF_WEATHER_ICONS] = {
@@ -36,6 +93,11 @@ static const uint32_t WEATHER_ICONS[NUMBER_OF_WEATHER_ICONS] = {
     RESOURCE_ID_IMAGE_NOWEATHER // 4
 };
 
+typedef struct {
+    BitmapLayer *layer;
+    GBitmap *slice;
+} AnimBand;
+
 static Window *s_window;
 
 static const char *day_names[] = {
@@ -46,25 +108,17 @@ static const char *month_names[] = {
     "JAN", "FEB", "MAR", "APR", "MAI", "JUN", "JUL", "AUG", "SEP", "OKT", "NOV", "DES"
 };
 
-static const int IMAGE_RESOURCE_D_IDS[NUMBER_OF_IMAGES] = {
-    RESOURCE_ID_IMAGE_NUM_0_d, RESOURCE_ID_IMAGE_NUM_1_d, RESOURCE_ID_IMAGE_NUM_2_d, RESOURCE_ID_IMAGE_NUM_3_d,
-    RESOURCE_ID_IMAGE_NUM_4_d, RESOURCE_ID_IMAGE_NUM_5_d, RESOURCE_ID_IMAGE_NUM_6_d, RESOURCE_ID_IMAGE_NUM_7_d,
-    RESOURCE_ID_IMAGE_NUM_8_d, RESOURCE_ID_IMAGE_NUM_9_d, RESOURCE_ID_IMAGE_NUM_10_d, RESOURCE_ID_IMAGE_NUM_11_d
-};
-
-static const int IMAGE_RESOURCE_B_IDS[NUMBER_OF_IMAGES] = {
-    RESOURCE_ID_IMAGE_NUM_0_b, RESOURCE_ID_IMAGE_NUM_1_b, RESOURCE_ID_IMAGE_NUM_2_b, RESOURCE_ID_IMAGE_NUM_3_b,
-    RESOURCE_ID_IMAGE_NUM_4_b, RESOURCE_ID_IMAGE_NUM_5_b, RESOURCE_ID_IMAGE_NUM_6_b, RESOURCE_ID_IMAGE_NUM_7_b,
-    RESOURCE_ID_IMAGE_NUM_8_b, RESOURCE_ID_IMAGE_NUM_9_b, RESOURCE_ID_IMAGE_NUM_10_b, RESOURCE_ID_IMAGE_NUM_11_b
-};
-
-static GBitmap *s_d_images[NUMBER_OF_IMAGES];
-static GBitmap *s_b_images[NUMBER_OF_IMAGES];
 static GBitmap *s_weather_images[NUMBER_OF_WEATHER_ICONS];
+#if PROFILE_ANIMATIONS
 static GBitmap *s_anim_image = NULL;
-static GBitmap *s_ingress_slice_image1 = NULL;
-static GBitmap *s_ingress_slice_image2 = NULL;
-static BitmapLayer *s_image_layers[TOTAL_IMAGE_SLOTS];
+static Timeline *s_timeline = NULL;
+static SchedTask *s_anim_start_task = NULL;
+static AnimBand s_anim_bands[ANIM_BANDS];
+static int s_animation_mode;
+static time_t s_last_anim_secs = 0;
+#endif
+static Layer *s_digits_layer = NULL;
+static uint8_t s_slot_glyphs[TOTAL_IMAGE_SLOTS];
 static BitmapLayer *s_weather_layer = NULL;
 static TextLayer *s_time_details_layer_bg = NULL;
 static TextLayer *s_time_details_layer = NULL;
@@ -73,11 +127,11 @@ static TextLayer *s_day_layer = NULL;
 static TextLayer *s_steps_layer = NULL;
 static TextLayer *s_temp_layer_bg = NULL;
 static TextLayer *s_temp_layer = NULL;
+static Layer *s_frame_snapshot_layer = NULL;
+static bool s_frame_snapshot_drawn = false;
 static Layer *s_battery_layer = NULL;
 static Layer *s_humidity_layer = NULL;
 static Layer *s_bt_layer = NULL;
-static BitmapLayer *s_ingress_layer1 = NULL;
-static BitmapLayer *s_ingress_layer2 = NULL;
 static TextLayer *s_alarm_layer_bg = NULL;
 static TextLayer *s_alarm_layer = NULL;
 static BatteryChargeState s_battery_state;
@@ -85,48 +139,112 @@ static bool s_bt_connected;
 static int s_temp = 99;
 static int s_weather_icon = 4;
 static int s_weather_hum = 0;
-static time_t s_last_temp_update_secs = 0;
-static time_t s_last_anim_secs = 0;
+static time_t s_next_fetch_secs = 0;
+static MqHandle s_data_request = 0;
+static MqHandle s_diagnostics_request = 0;
+static char s_diagnostics[DIAGNOSTICS_MAX_LENGTH];
+static uint8_t s_forecast_blob[FORECAST_BLOB_HEADER_SIZE + FORECAST_MAX_HOURS * FORECAST_PACKED_ENTRY_SIZE];
+static uint32_t s_state_version = 0;
+static time_t s_weather_hour = 0;
+static int32_t s_steps = 0;
+static bool s_steps_known = false;
 static time_t s_alarm_secs = 0;
 static bool s_animation_running = false;
-static int s_animation_mode;
 static bool s_alarm_faraway = 0;
-static GFont s_font30;
-static GFont s_font54;
+static GFont s_font30 = NULL;
+#if PROFILE_STEPS_FONT
+static GFont s_font54 = NULL;
+#endif
 static bool s_default_mode = false;
 static int s_default_mode_countdown = 2;
-static AppTimer *s_bck_light_window_unset_timer = NULL;
+static SchedTask *s_bck_light_window_unset_task = NULL;
 static bool s_bck_already_on = false;
+static SchedTask *s_frame_snapshot_task = NULL;
+static bool s_frame_snapshot_due = false;
+static time_t s_frame_snapshot_secs = 0;
+static size_t s_heap_before_load = 0;
 
 // ------------------------------------------------------
-static void set_digit_into_slot(int slot_number, GBitmap *bitmap) {
-    bitmap_layer_set_bitmap(s_image_layers[slot_number], bitmap);
+static void destroy_bitmap(GBitmap **bitmap) {
+    if (*bitmap) {
+        gbitmap_destroy(*bitmap);
+        *bitmap = NULL;
+    }
+}
+
+static void destroy_layer(Layer **layer) {
+    if (*layer) {
+        layer_destroy(*layer);
+        *layer = NULL;
+    }
+}
+
+static void destroy_text_layer(TextLayer **layer) {
+    if (*layer) {
+        text_layer_destroy(*layer);
+        *layer = NULL;
+    }
+}
+
+static void destroy_bitmap_layer(BitmapLayer **layer) {
+    if (*layer) {
+        bitmap_layer_destroy(*layer);
+        *layer = NULL;
+    }
+}
+
+static void set_digit_into_slot(int slot_number, uint8_t glyph) {
+    if (s_slot_glyphs[slot_number] != glyph) {
+        s_slot_glyphs[slot_number] = glyph;
+        layer_mark_dirty(s_digits_layer);
+    }
+}
+
+// Steps normally come from the worker, reading health here is only a fallback
+static void read_local_steps() {
+#if defined(PBL_HEALTH)
+    HealthMetric metric = HealthMetricStepCount;
+    time_t start = time_start_of_today();
+    time_t end = time(NULL);
+
+    HealthServiceAccessibilityMask mask = health_service_metric_accessible(metric, start, end);
+
+    s_steps_known = mask & HealthServiceAccessibilityMaskAvailable;
+    if (s_steps_known) {
+        s_steps = health_service_sum_today(metric);
+    }
+#endif
+}
+
+static void update_steps_text() {
+    static char steps_text[] = "       ";
+
+    if (s_steps_known) {
+        snprintf(steps_text, 6, "%d", (int)s_steps);
+        text_layer_set_text(s_steps_layer, steps_text);
+    } else {
+        text_layer_set_text(s_steps_layer, "");
+    }
+}
+
+static void display_digits(struct tm *tick_time) {
+    set_digit_into_slot(0, tick_time->tm_hour % 12);
+    set_digit_into_slot(1, tick_time->tm_min / 10);
+    set_digit_into_slot(2, tick_time->tm_min % 10);
 }
 
 static void display_time_or_steps(struct tm *tick_time) {
-    set_digit_into_slot(0, s_b_images[tick_time->tm_hour % 12]);
-    set_digit_into_slot(1, s_d_images[tick_time->tm_min / 10]);
-    set_digit_into_slot(2, s_d_images[tick_time->tm_min % 10]);
+    display_digits(tick_time);
 
     if (s_default_mode) {
-        static char steps_text[] = "       ";
-
         text_layer_set_text(s_day_layer, "");
         text_layer_set_text(s_time_details_layer, "");
 
-        HealthMetric metric = HealthMetricStepCount;
-        time_t start = time_start_of_today();
-        time_t end = time(NULL);
-
-        HealthServiceAccessibilityMask mask = health_service_metric_accessible(metric, start, end);
-
-        if (mask & HealthServiceAccessibilityMaskAvailable) {
-            snprintf(steps_text, 6, "%d", (int)health_service_sum_today(metric));
-            text_layer_set_text(s_steps_layer, steps_text);
-        } else {
-            text_layer_set_text(s_steps_layer, "");
+        if (!app_worker_is_running()) {
+            read_local_steps();
         }
 
+        update_steps_text();
     } else {
         static char week_text[] = "W00";
         static char time_details_text[] = "                  ";
@@ -158,7 +276,7 @@ static void paint_battery_layer(Layer *layer, GContext *ctx) {
     GPoint p0 = GPoint(0, 0);
     GPoint p1 = GPoint(x, 0);
     GPoint p2 = GPoint(144, 0);
-    graphics_context_set_stroke_color(ctx, (s_battery_state.charge_percent < 15) ? GColorRed : GColorCyan);
+    graphics_context_set_stroke_color(ctx, (s_battery_state.charge_percent < 15) ? COLOR_FALLBACK(GColorRed, GColorWhite) : COLOR_FALLBACK(GColorCyan, GColorWhite));
     graphics_context_set_stroke_width(ctx, 6);
     graphics_draw_line(ctx, p0, p1);
     graphics_context_set_stroke_color(ctx, GColorBlack);
@@ -179,19 +297,26 @@ static void paint_humidity_layer(Layer *layer, GContext *ctx) {
     GPoint p1 = GPoint(0, y);
     GPoint p2 = GPoint(0, 168);
     graphics_context_set_stroke_width(ctx, 6);
-    graphics_context_set_stroke_color(ctx, GColorVividCerulean);
+    graphics_context_set_stroke_color(ctx, COLOR_FALLBACK(GColorVividCerulean, GColorWhite));
     graphics_draw_line(ctx, p1, p2);
 }
 
 static void paint_bt_layer(Layer *layer, GContext *ctx) {
     if (!s_bt_connected) {
-        graphics_context_set_stroke_color(ctx, GColorRed);
+        graphics_context_set_stroke_color(ctx, COLOR_FALLBACK(GColorRed, GColorWhite));
         graphics_context_set_stroke_width(ctx, 4);
         graphics_draw_line(ctx, GPoint(0, 0), GPoint(144, 0));
         graphics_draw_line(ctx, GPoint(143, 0), GPoint(143, 168));
         graphics_draw_line(ctx, GPoint(143, 167), GPoint(0, 167));
         graphics_draw_line(ctx, GPoint(0, 167), GPoint(0, 0));
     }
+
+    // This is the last layer, so the frame is complete here
+    if (s_frame_snapshot_due) {
+        s_frame_snapshot_due = false;
+        s_frame_snapshot_secs = time(NULL);
+        frame_snapshot_save(ctx, DIGIT_HEIGHT);
+    }
 }
 
 static void update_temp() {
@@ -200,7 +325,7 @@ static void update_temp() {
     if (s_temp_layer != NULL) {
         snprintf(buf, sizeof(buf), "%d", abs(s_temp));
         text_layer_set_text(s_temp_layer, buf);
-        text_layer_set_background_color(s_temp_layer_bg, (s_temp >= 0) ? GColorBulgarianRose : GColorOxfordBlue);
+        text_layer_set_background_color(s_temp_layer_bg, (s_temp >= 0) ? COLOR_FALLBACK(GColorBulgarianRose, GColorBlack) : COLOR_FALLBACK(GColorOxfordBlue, GColorBlack));
     }
 }
 
@@ -251,14 +376,197 @@ static void update_alarm_time() {
     }
 }
 
+static time_t next_fetch_time(time_t fetched_at) {
+    time_t next = fetched_at + FETCH_INTERVAL_SECS;
+
+    // Long enough forecast lets us stay away from the radio for hours
+    if (forecast_hours_left(fetched_at) > FORECAST_REFETCH_HOURS) {
+        next = MIN(forecast_end() - FORECAST_REFETCH_HOURS * 60 * 60, fetched_at + FORECAST_FETCH_INTERVAL_SECS);
+        next = MAX(next, fetched_at + FETCH_INTERVAL_SECS);
+    }
+
+    return next;
+}
+
+static void save_data_snapshot() {
+    time_t now = time(NULL);
+    s_next_fetch_secs = next_fetch_time(now);
+
+    DataSnapshot data = {
+        .fetched_at = now,
+        .next_fetch_at = s_next_fetch_secs,
+        .state_version = s_state_version,
+        .alarm_mins = s_alarm_secs / 60,
+        .temp = s_temp,
+        .icon = s_weather_icon,
+        .hum = s_weather_hum
+    };
+
+    persist_write_data(PERSIST_KEY_DATA, &data, sizeof(data));
+
+    // Worker reschedules next fetch from the persisted time
+    AppWorkerMessage msg = {0};
+    app_worker_send_message(WORKER_MSG_FETCHED, &msg);
+}
+
+// Whatever worker and previous runs left, so the face starts with data
+static void load_snapshots() {
+    DataSnapshot data;
+    if (persist_read_data(PERSIST_KEY_DATA, &data, sizeof(data)) == sizeof(data)) {
+        s_temp = data.temp;
+        s_weather_icon = data.icon;
+        s_weather_hum = data.hum;
+        s_alarm_secs = ((long)data.alarm_mins) * 60L;
+        s_next_fetch_secs = data.next_fetch_at;
+        s_state_version = data.state_version;
+        s_weather_hour = data.fetched_at - data.fetched_at % (60 * 60);
+    }
+
+    forecast_load(PERSIST_KEY_FORECAST);
+
+    StepsSnapshot steps;
+    if (persist_read_data(PERSIST_KEY_STEPS, &steps, sizeof(steps)) == sizeof(steps)
+            && steps.available && steps.day_start == time_start_of_today()) {
+        s_steps = steps.steps;
+        s_steps_known = true;
+    }
+}
+
+// Moves displayed weather along the forecast once per hour, without the radio
+static void apply_forecast(time_t now) {
+    time_t hour_start = now - now % (60 * 60);
+    if (hour_start == s_weather_hour) {
+        return;
+    }
+
+    ForecastHour hour;
+    if (!forecast_lookup(now, &hour)) {
+        return;
+    }
+
+    s_weather_hour = hour_start;
+    s_temp = hour.temp;
+    s_weather_icon = hour.icon;
+    s_weather_hum = hour.hum;
+
+    update_temp();
+    update_weather_icon();
+
+    if (s_humidity_layer) {
+        layer_mark_dirty(s_humidity_layer);
+    }
+}
+
+// Versioned response only carries fields that changed, only those are applied and redrawn.
+// Response without a version is a full one: missing fields get defaults and forecast is dropped.
+static void apply_data_response(uint8_t present, int8_t temp, int8_t icon, int8_t hum, int32_t alarm_mins,
+                                uint32_t forecast_start, const Tuple *forecast, uint32_t state_version) {
+    if (!(present & MASK_DATA_VERSION)) {
+        present |= MASK_DATA_ALL_VALUES;
+        state_version = 0;
+    }
+
+    if (present & MASK_DATA_TEMP) {
+        s_temp = temp;
+        update_temp();
+    }
+
+    if (present & MASK_DATA_COND) {
+        s_weather_icon = icon;
+        update_weather_icon();
+    }
+
+    if (present & MASK_DATA_HUM) {
+        s_weather_hum = hum;
+        if (s_humidity_layer) {
+            layer_mark_dirty(s_humidity_layer);
+        }
+    }
+
+    if (present & MASK_DATA_ALARM) {
+        s_alarm_secs = ((long)MAX(alarm_mins, 0)) * 60L;
+        update_alarm_time();
+    }
+
+    if (present & MASK_DATA_FORECAST) {
+        forecast_set(forecast_start, forecast->value->data, forecast->length);
+        forecast_save(PERSIST_KEY_FORECAST);
+    } else if (!state_version) {
+        forecast_clear();
+        forecast_save(PERSIST_KEY_FORECAST);
+    }
+
+    // Values just received are valid for the current hour
+    time_t now = time(NULL);
+    s_weather_hour = now - now % (60 * 60);
+
+    s_state_version = state_version;
+    save_data_snapshot();
+}
+
+// Replaces the forecast and shows the current hour of it right away
+static void forecast_blob_received(uint8_t cmd, const uint8_t *data, uint16_t length, void *context) {
+    if (cmd != CMD_IN_FORECAST || length < FORECAST_BLOB_HEADER_SIZE) {
+        return;
+    }
+
+    uint32_t start = data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+    forecast_set(start, data + FORECAST_BLOB_HEADER_SIZE, length - FORECAST_BLOB_HEADER_SIZE);
+    forecast_save(PERSIST_KEY_FORECAST);
+
+    s_weather_hour = 0;
+    apply_forecast(time(NULL));
+}
+
+static void diagnostics_done(MqHandle handle, MqStatus status, uint32_t latency_ms, void *context) {
+    s_diagnostics_request = 0;
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Diagnostics: status=%d, %u ms", status, (unsigned int)latency_ms);
+}
+
+// Report stays in s_diagnostics until it is sent, so only one at a time
+static void send_diagnostics() {
+    if (s_diagnostics_request) {
+        return;
+    }
+
+    MqStats stats;
+    mq_get_stats(&stats);
+
+    int length = snprintf(s_diagnostics, sizeof(s_diagnostics),
+            "startup: first frame %u ms, total %u ms\n"
+            "mq: dropped %u, expired %u, failed %u\n"
+            "wakeups: %u this hour, %u last hour\n"
+            "heap: used %u, free %u, budget %u\n",
+            startup_get_first_frame_ms(), startup_get_total_ms(),
+            stats.dropped, stats.expired, stats.failed,
+            sched_get_wakeups_this_hour(), sched_get_wakeups_last_hour(),
+            (unsigned int)heap_bytes_used(), (unsigned int)heap_bytes_free(), (unsigned int)PROFILE_HEAP_BUDGET);
+
+    MqRecord record = {
+        .cmd = CMD_OUT_DIAGNOSTICS
+    };
+
+    MqOptions options = {
+        .priority = MQ_PRIORITY_BULK,
+        .ttl_secs = MQ_DEFAULT_TTL_SECS,
+        .completion = diagnostics_done
+    };
+
+    s_diagnostics_request = mq_submit_blob(&record, (const uint8_t *)s_diagnostics,
+                                           MIN(length, (int)sizeof(s_diagnostics) - 1), &options);
+}
+
 static void inbox_received_callback(DictionaryIterator *iterator) {
     uint8_t cmd = 0;
+    uint8_t present = 0;
 
     int8_t msg_weather_temp = 99;
     int8_t msg_weather_hum = 0;
-    int8_t msg_weather_wind = 99;
     int8_t msg_weather_icon = 4;
     int32_t msg_alarm_mins = 0;
+    uint32_t msg_forecast_start = 0;
+    Tuple *msg_forecast = NULL;
+    uint32_t msg_state_version = 0;
 
     // Read first item
     Tuple *t = dict_read_first(iterator);
@@ -273,18 +581,35 @@ static void inbox_received_callback(DictionaryIterator *iterator) {
 
             case CMD_IN_GET_DATA_RESPONSE_ALARM_TIME:
                 msg_alarm_mins = t->value->int32;
+                present |= MASK_DATA_ALARM;
                 break;
 
             case CMD_IN_GET_DATA_RESPONSE_WEATHER_TEMP:
                 msg_weather_temp = t->value->int8;
+                present |= MASK_DATA_TEMP;
                 break;
 
             case CMD_IN_GET_DATA_RESPONSE_WEATHER_COND:
                 msg_weather_icon = t->value->int8;
+                present |= MASK_DATA_COND;
                 break;
 
             case CMD_IN_GET_DATA_RESPONSE_WEATHER_HUM:
                 msg_weather_hum = t->value->int8;
+                present |= MASK_DATA_HUM;
+                break;
+
+            case CMD_IN_GET_DATA_RESPONSE_FORECAST_START:
+                msg_forecast_start = t->value->uint32;
+                break;
+
+            case CMD_IN_GET_DATA_RESPONSE_FORECAST:
+                msg_forecast = t;
+                break;
+
+            case CMD_IN_GET_DATA_RESPONSE_STATE_VERSION:
+                msg_state_version = t->value->uint32;
+                present |= MASK_DATA_VERSION;
                 break;
 
             case CMD_IN_GET_DATA_RESPONSE_WEATHER_WIND:
@@ -303,23 +628,24 @@ static void inbox_received_callback(DictionaryIterator *iterator) {
         return; // cmd is missing
     }
 
+    if (msg_forecast && msg_forecast_start) {
+        present |= MASK_DATA_FORECAST;
+    }
+
     // Perform command
     switch(cmd) {
-        case CMD_IN_GET_DATA_RESPONSE:
-            s_temp = msg_weather_temp;
-            s_weather_icon = msg_weather_icon;
-            s_weather_hum = msg_weather_hum;
-
-            if (msg_alarm_mins < 0) {
-                msg_alarm_mins = 0;
-            }
+        case CMD_IN_GET_DIAGNOSTICS:
+            send_diagnostics();
+            break;
 
-            s_alarm_secs = ((long)msg_alarm_mins) * 60L;
+        case CMD_IN_GET_DATA_NOT_MODIFIED:
+            // Nothing changed since the version we hold, only the schedule moves
+            save_data_snapshot();
+            break;
 
-            update_temp();
-            update_weather_icon();
-            update_alarm_time();
-            layer_mark_dirty(window_get_root_layer(s_window));
+        case CMD_IN_GET_DATA_RESPONSE:
+            apply_data_response(present, msg_weather_temp, msg_weather_icon, msg_weather_hum, msg_alarm_mins,
+                                msg_forecast_start, msg_forecast, msg_state_version);
             break;
 
         default:
@@ -327,113 +653,95 @@ static void inbox_received_callback(DictionaryIterator *iterator) {
     }
 }
 
-static void my_animation_started(Animation *animation, void *context) {
-    if (s_animation_mode & 1) {
-        int anim_img_y1 = 0;
-        int anim_scr_y1 = 0;
-
-        // Prepare initial layers and stuff
-        if (s_ingress_layer1) {
-            bitmap_layer_destroy(s_ingress_layer1);
-            s_ingress_layer1 = NULL;
-        }
+#if PROFILE_ANIMATIONS
+static void band_apply(int16_t y, void *context) {
+    AnimBand *band = context;
 
-        if (s_ingress_layer2) {
-            bitmap_layer_destroy(s_ingress_layer2);
-            s_ingress_layer2 = NULL;
-        }
-
-        s_ingress_layer1 = bitmap_layer_create(GRect(0, anim_scr_y1, SCR_WIDTH, ANIM_HEIGHT));
-        bitmap_layer_set_compositing_mode(s_ingress_layer1, GCompOpSet);
-        layer_add_child(window_get_root_layer(s_window), bitmap_layer_get_layer(s_ingress_layer1));
+    // Slice bitmap is only moved over the shared image, nothing is allocated per frame
+    gbitmap_set_bounds(band->slice, GRect(0, y, SCR_WIDTH, ANIM_HEIGHT));
+    layer_set_frame(bitmap_layer_get_layer(band->layer), GRect(0, y, SCR_WIDTH, ANIM_HEIGHT));
+}
 
-        if (s_ingress_slice_image1) {
-            gbitmap_destroy(s_ingress_slice_image1);
-            s_ingress_slice_image1 = NULL;
-        }
+static void band_create(AnimBand *band, int16_t y) {
+    band->layer = bitmap_layer_create(GRect(0, y, SCR_WIDTH, ANIM_HEIGHT));
+    bitmap_layer_set_compositing_mode(band->layer, GCompOpSet);
+    layer_add_child(window_get_root_layer(s_window), bitmap_layer_get_layer(band->layer));
 
-        s_ingress_slice_image1 = gbitmap_create_as_sub_bitmap(s_anim_image, GRect(0, anim_img_y1, SCR_WIDTH, ANIM_HEIGHT));
+    band->slice = gbitmap_create_as_sub_bitmap(s_anim_image, GRect(0, y, SCR_WIDTH, ANIM_HEIGHT));
+    bitmap_layer_set_bitmap(band->layer, band->slice);
+}
 
-        bitmap_layer_set_bitmap(s_ingress_layer1, s_ingress_slice_image1);
+static void band_destroy(AnimBand *band) {
+    if (band->layer) {
+        bitmap_layer_destroy(band->layer);
+        band->layer = NULL;
     }
 
-    if (s_animation_mode & 2) {
-        int anim_img_y2 = SCR_HEIGHT - ANIM_HEIGHT;
-        int anim_scr_y2 = SCR_HEIGHT - ANIM_HEIGHT;
-
-        s_ingress_layer2 = bitmap_layer_create(GRect(0, anim_scr_y2, SCR_WIDTH, ANIM_HEIGHT));
-        bitmap_layer_set_compositing_mode(s_ingress_layer2, GCompOpSet);
-        layer_add_child(window_get_root_layer(s_window), bitmap_layer_get_layer(s_ingress_layer2));
-
-        if (s_ingress_slice_image2) {
-            gbitmap_destroy(s_ingress_slice_image2);
-            s_ingress_slice_image2 = NULL;
-        }
-
-        s_ingress_slice_image2 = gbitmap_create_as_sub_bitmap(s_anim_image, GRect(0, anim_img_y2, SCR_WIDTH, ANIM_HEIGHT));
-
-        bitmap_layer_set_bitmap(s_ingress_layer2, s_ingress_slice_image2);
+    if (band->slice) {
+        gbitmap_destroy(band->slice);
+        band->slice = NULL;
     }
 }
 
-static void my_animation_update(Animation *animation, AnimationProgress progress) {
-    if (s_animation_mode & 1) {
-        int anim_img_y1 = SCR_HEIGHT - ANIM_HEIGHT - progress / (ANIMATION_NORMALIZED_MAX / (SCR_HEIGHT - ANIM_HEIGHT));
-        int anim_scr_y1 = anim_img_y1;
-
-        //APP_LOG(APP_LOG_LEVEL_DEBUG, "Loop index now p=%d, imgy=%d, scry=%d", (int)progress, anim_img_y, anim_scr_y);
-
-        if (s_ingress_slice_image1) {
-            gbitmap_destroy(s_ingress_slice_image1);
-            s_ingress_slice_image1 = NULL;
-        }
-
-        s_ingress_slice_image1 = gbitmap_create_as_sub_bitmap(s_anim_image, GRect(0, anim_img_y1, SCR_WIDTH, ANIM_HEIGHT));
+static void animation_render(void *context) {
+    layer_mark_dirty(window_get_root_layer(s_window));
+}
 
-        layer_set_frame(bitmap_layer_get_layer(s_ingress_layer1), GRect(0, anim_scr_y1, SCR_WIDTH, ANIM_HEIGHT));
+static void animation_stopped(Timeline *timeline, bool finished, void *context) {
+    s_animation_running = false;
 
-        bitmap_layer_set_bitmap(s_ingress_layer1, s_ingress_slice_image1);
+    for (int i = 0; i < ANIM_BANDS; i++) {
+        band_destroy(&s_anim_bands[i]);
     }
 
-    if (s_animation_mode & 2) {
-        int anim_img_y2 = progress / (ANIMATION_NORMALIZED_MAX / (SCR_HEIGHT - ANIM_HEIGHT));
-        int anim_scr_y2 = anim_img_y2;
-
-        //APP_LOG(APP_LOG_LEVEL_DEBUG, "Loop index now p=%d, imgy=%d, scry=%d", (int)progress, anim_img_y, anim_scr_y);
-
-        if (s_ingress_slice_image2) {
-            gbitmap_destroy(s_ingress_slice_image2);
-            s_ingress_slice_image2 = NULL;
-        }
-
-        s_ingress_slice_image2 = gbitmap_create_as_sub_bitmap(s_anim_image, GRect(0, anim_img_y2, SCR_WIDTH, ANIM_HEIGHT));
-
-        layer_set_frame(bitmap_layer_get_layer(s_ingress_layer2), GRect(0, anim_scr_y2, SCR_WIDTH, ANIM_HEIGHT));
+    timeline_destroy(timeline);
+    s_timeline = NULL;
 
-        bitmap_layer_set_bitmap(s_ingress_layer2, s_ingress_slice_image2);
+    if (s_anim_image) {
+        gbitmap_destroy(s_anim_image);
+        s_anim_image = NULL;
     }
-
-    layer_mark_dirty(window_get_root_layer(s_window));
 }
 
-static void my_animation_stopped(Animation *animation, bool finished, void *context) {
-    s_animation_running = false;
+// Bands only appear once the delay is over, so they don't stand still on screen while waiting
+static void begin_animation(void *context) {
+    s_anim_start_task = NULL;
 
-    if (s_ingress_layer1) {
-        bitmap_layer_destroy(s_ingress_layer1);
-        s_ingress_layer1 = NULL;
+    s_timeline = timeline_create(ANIM_DURATION, ANIM_FPS);
+    if (!s_timeline) {
+        animation_stopped(NULL, false, NULL);
+        return;
     }
 
-    if (s_ingress_layer2) {
-        bitmap_layer_destroy(s_ingress_layer2);
-        s_ingress_layer2 = NULL;
+    timeline_set_reverse(s_timeline, true);
+    timeline_set_handlers(s_timeline, animation_render, animation_stopped, NULL);
+
+    // Tracks run in reverse: upper band starts at the top and sweeps down,
+    // lower band starts at the bottom and sweeps up
+    if (s_animation_mode & 1) {
+        band_create(&s_anim_bands[0], 0);
+        timeline_add_track(s_timeline, &(TimelineTrack) {
+            .curve = AnimationCurveEaseInOut,
+            .from = SCR_HEIGHT - ANIM_HEIGHT,
+            .to = 0,
+            .apply = band_apply,
+            .context = &s_anim_bands[0]
+        });
     }
 
-    animation_destroy(animation);
+    if (s_animation_mode & 2) {
+        band_create(&s_anim_bands[1], SCR_HEIGHT - ANIM_HEIGHT);
+        timeline_add_track(s_timeline, &(TimelineTrack) {
+            .curve = AnimationCurveEaseInOut,
+            .from = 0,
+            .to = SCR_HEIGHT - ANIM_HEIGHT,
+            .apply = band_apply,
+            .context = &s_anim_bands[1]
+        });
+    }
 
-    if (s_anim_image) {
-        gbitmap_destroy(s_anim_image);
-        s_anim_image = NULL;
+    if (!timeline_start(s_timeline)) {
+        animation_stopped(s_timeline, false, NULL);
     }
 }
 
@@ -457,25 +765,66 @@ static void start_animation() {
         s_anim_image = gbitmap_create_with_resource(RESOURCE_ID_IMAGE_NOISE);
     }
 
-    // Animation itself
-    Animation *animation = animation_create();
-    animation_set_duration(animation, ANIM_DURATION);
-    animation_set_delay(animation, ANIM_DELAY);
-    animation_set_curve(animation, AnimationCurveEaseInOut);
-    animation_set_reverse(animation, true);
+    // Delay is a scheduler task, so it can share a wakeup with something else
+    s_anim_start_task = sched_add(ANIM_DELAY, ANIM_DELAY_SLACK_MS, begin_animation, NULL);
+}
 
-    static AnimationImplementation anim_impl = {
-        .update = my_animation_update
+// Works whether the animation is waiting for its delay, running or not there at all
+static void stop_animation() {
+    if (s_anim_start_task) {
+        // Still waiting for the delay, only the image is loaded by now
+        sched_cancel(s_anim_start_task);
+        s_anim_start_task = NULL;
+        animation_stopped(NULL, false, NULL);
+    } else if (s_timeline) {
+        animation_stopped(s_timeline, false, NULL);
+    }
+}
+#else
+static void start_animation() {
+}
+
+static void stop_animation() {
+}
+#endif
+
+static void data_request_done(MqHandle handle, MqStatus status, uint32_t latency_ms, void *context) {
+    s_data_request = 0;
+
+    if (status == MQ_STATUS_DELIVERED) {
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Data request delivered in %u ms", (unsigned int)latency_ms);
+    } else {
+        // Don't wait for the whole interval if it never reached the phone
+        s_next_fetch_secs = time(NULL) + DATA_RETRY_SECS;
+    }
+}
+
+static void request_data() {
+    // One outstanding request is enough, and a saturated link doesn't need more
+    if (s_data_request || mq_pressure() == MQ_PRESSURE_SATURATED) {
+        return;
+    }
+
+    MqRecord request = {
+        .cmd = CMD_OUT_GET_DATA,
+        .field_count = 2,
+        .fields = {
+            { .key = CMD_OUT_GET_DATA_FORECAST_HOURS, .type = MQ_FIELD_UINT8, .value = FORECAST_MAX_HOURS },
+            { .key = CMD_OUT_GET_DATA_STATE_VERSION, .type = MQ_FIELD_UINT32, .value = s_state_version }
+        }
     };
 
-    animation_set_implementation(animation, &anim_impl);
-    animation_set_handlers(animation, (AnimationHandlers) {
-        .started = my_animation_started,
-        .stopped = my_animation_stopped,
-    }, NULL);
+    MqOptions options = {
+        .priority = MQ_PRIORITY_BULK,
+        .ttl_secs = GET_DATA_TTL_SECS,
+        .completion = data_request_done
+    };
 
-    // Start it
-    animation_schedule(animation);
+    s_data_request = mq_submit(&request, &options);
+    if (s_data_request) {
+        // Retried sooner by data_request_done if it fails
+        s_next_fetch_secs = time(NULL) + FETCH_INTERVAL_SECS;
+    }
 }
 
 static void show_default_mode() {
@@ -500,6 +849,27 @@ static void toggle_alt_mode() {
     display_time_or_steps(tick_time);
 }
 
+static void frame_snapshot_settled(void *context) {
+    s_frame_snapshot_task = NULL;
+
+    // Animation bands are above the last layer, wait until they are gone
+    if (s_animation_running || !s_bt_layer) {
+        return;
+    }
+
+    s_frame_snapshot_due = true;
+    layer_mark_dirty(s_bt_layer);
+}
+
+static void request_frame_snapshot() {
+    if (s_frame_snapshot_task || time(NULL) - s_frame_snapshot_secs < FRAME_SNAPSHOT_INTERVAL_SECS) {
+        return;
+    }
+
+    s_frame_snapshot_task = sched_add(FRAME_SNAPSHOT_SETTLE_MS, FRAME_SNAPSHOT_SETTLE_SLACK_MS,
+                                      frame_snapshot_settled, NULL);
+}
+
 static void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
     if (!s_default_mode && s_default_mode_countdown) {
         s_default_mode_countdown -= 1;
@@ -512,10 +882,16 @@ static void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
 
     time_t cur_time = time(NULL);
 
-    if (cur_time - s_last_temp_update_secs > 30*60) {
+    apply_forecast(cur_time);
+
+    if (startup_is_done()) {
+        request_frame_snapshot();
+    }
+
+    // Normally worker tells when it is time to fetch
+    if (!app_worker_is_running() && cur_time >= s_next_fetch_secs) {
         // Send a message to android pebble app
-        s_last_temp_update_secs = cur_time;
-        mq_add(CMD_OUT_GET_DATA, "");
+        request_data();
     }
 
     if (rand() % 5 == 0) {
@@ -535,11 +911,37 @@ static void handle_minute_tick(struct tm *tick_time, TimeUnits units_changed) {
         };
         vibes_enqueue_custom_pattern(pat);
     }
+
+    // Deferred work that can wait runs on this wakeup
+    sched_on_minute_tick();
+}
+
+static void worker_message_handler(uint16_t type, AppWorkerMessage *data) {
+    switch (type) {
+        case WORKER_MSG_STEPS:
+            // Without health (always the case on aplite) there is nothing to show, not zero steps
+            s_steps_known = data->data2 != 0;
+            if (s_steps_known) {
+                s_steps = data->data0 | ((int32_t)data->data1 << 16);
+            }
+
+            if (s_default_mode && s_steps_layer) {
+                update_steps_text();
+            }
+            break;
+
+        case WORKER_MSG_FETCH_DUE:
+            request_data();
+            break;
+
+        default:
+            break;
+    }
 }
 
 static void bck_light_window_unset(void *context) {
     s_bck_already_on = false;
-    s_bck_light_window_unset_timer = NULL;
+    s_bck_light_window_unset_task = NULL;
 }
 
 static void accel_tap_handler(AccelAxisType axis, int32_t direction) {
@@ -549,120 +951,195 @@ static void accel_tap_handler(AccelAxisType axis, int32_t direction) {
 
     s_bck_already_on = true;
 
-    if (s_bck_light_window_unset_timer) {
-        app_timer_reschedule(s_bck_light_window_unset_timer, 4000);
+    if (s_bck_light_window_unset_task) {
+        sched_reschedule(s_bck_light_window_unset_task, TAP_WINDOW_MS);
     } else {
-        s_bck_light_window_unset_timer = app_timer_register(4000, bck_light_window_unset, NULL);
+        s_bck_light_window_unset_task = sched_add(TAP_WINDOW_MS, TAP_WINDOW_SLACK_MS, bck_light_window_unset, NULL);
     }
 }
 
-static void window_load(Window *window) {
-    window_set_background_color(window, GColorBlack);
+static void check_heap_budget() {
+    unsigned int used = heap_bytes_used();
 
-    s_font30 = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_34));
-    s_font54 = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_54));
+    if (used > PROFILE_HEAP_BUDGET) {
+        APP_LOG(APP_LOG_LEVEL_WARNING, "Heap budget exceeded: used=%u, budget=%u, free=%u",
+                used, (unsigned int)PROFILE_HEAP_BUDGET, (unsigned int)heap_bytes_free());
+    } else {
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Heap: used=%u, budget=%u, free=%u",
+                used, (unsigned int)PROFILE_HEAP_BUDGET, (unsigned int)heap_bytes_free());
+    }
+}
 
-    // 48x67
-    for (int i = 0; i < NUMBER_OF_IMAGES; i++) {
-        s_d_images[i] = gbitmap_create_with_resource(IMAGE_RESOURCE_D_IDS[i]);
-        s_b_images[i] = gbitmap_create_with_resource(IMAGE_RESOURCE_B_IDS[i]);
+// Hours are on blue, minutes on the background
+static void paint_digits_layer(Layer *layer, GContext *ctx) {
+    // Layer is a direct child of the root layer, so its frame is in screen coordinates
+    GPoint origin = layer_get_frame(layer).origin;
+
+    for (int i = 0; i < TOTAL_IMAGE_SLOTS; i++) {
+        GColor background = i == 0 ? COLOR_FALLBACK(GColorDukeBlue, GColorBlack) : GColorBlack;
+        digits_draw(ctx, GPoint(origin.x + i * DIGIT_WIDTH, origin.y), s_slot_glyphs[i], background);
     }
 
-    for (uint i = 0; i < NUMBER_OF_WEATHER_ICONS; i++) {
-        s_weather_images[i] = gbitmap_create_with_resource(WEATHER_ICONS[i]);
+    // Digits are in every frame, the first one counts. Later calls return right away.
+    startup_mark_first_frame();
+}
+
+// Decoded once, the window background is clear until the placeholder is
+// gone, so the frame buffer keeps it for the following frames
+static void paint_frame_snapshot_layer(Layer *layer, GContext *ctx) {
+    if (s_frame_snapshot_drawn) {
+        return;
     }
 
-    Layer *window_layer = window_get_root_layer(window);
-    for (int i = 0; i < TOTAL_IMAGE_SLOTS; i++) {
-        BitmapLayer *bitmap_layer = bitmap_layer_create(GRect(i * 48, 0, 48, 67));
-        s_image_layers[i] = bitmap_layer;
-        layer_add_child(window_layer, bitmap_layer_get_layer(bitmap_layer));
+    s_frame_snapshot_drawn = true;
+    if (!frame_snapshot_draw(ctx)) {
+        graphics_context_set_fill_color(ctx, GColorBlack);
+        graphics_fill_rect(ctx, layer_get_bounds(layer), 0, GCornerNone);
+    }
+}
+
+// Stage: background and clock digits, this is the first frame
+static void load_clock() {
+    Layer *window_layer = window_get_root_layer(s_window);
+
+    window_set_background_color(s_window, GColorBlack);
+
+    // Last frame of the previous run below the clock digits stands in
+    // until the other stages are done
+    if (frame_snapshot_exists()) {
+        s_frame_snapshot_drawn = false;
+        s_frame_snapshot_layer = layer_create(GRect(0, DIGIT_HEIGHT, SCR_WIDTH, SCR_HEIGHT - DIGIT_HEIGHT));
+        layer_set_update_proc(s_frame_snapshot_layer, paint_frame_snapshot_layer);
+        layer_add_child(window_layer, s_frame_snapshot_layer);
+        window_set_background_color(s_window, GColorClear);
+    }
+
+    if (!digits_load(RESOURCE_ID_DIGITS_RLE)) {
+        APP_LOG(APP_LOG_LEVEL_ERROR, "Failed to load digits");
     }
 
+    s_digits_layer = layer_create(GRect(0, 0, TOTAL_IMAGE_SLOTS * DIGIT_WIDTH, DIGIT_HEIGHT));
+    layer_set_update_proc(s_digits_layer, paint_digits_layer);
+    layer_add_child(window_layer, s_digits_layer);
+
+    load_snapshots();
+
+    time_t now = time(NULL);
+    apply_forecast(now);
+    display_digits(localtime(&now));
+}
+
+// Stage: fonts and all texts
+static void load_texts() {
+    Layer *window_layer = window_get_root_layer(s_window);
+
+    s_font30 = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_34));
+#if PROFILE_STEPS_FONT
+    s_font54 = fonts_load_custom_font(resource_get_handle(RESOURCE_ID_FONT_54));
+#endif
+
     // Create time details TextLayer
     s_time_details_layer_bg = text_layer_create(GRect(0, 67, 144, 34));
-    text_layer_set_background_color(s_time_details_layer_bg, GColorImperialPurple);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_time_details_layer_bg));
+    text_layer_set_background_color(s_time_details_layer_bg, COLOR_FALLBACK(GColorImperialPurple, GColorBlack));
+    layer_add_child(window_layer, text_layer_get_layer(s_time_details_layer_bg));
 
     s_time_details_layer = text_layer_create(GRect(0, 67-4, 144, 34+2));
     text_layer_set_background_color(s_time_details_layer, GColorClear);
     text_layer_set_text_color(s_time_details_layer, GColorWhite);
     text_layer_set_font(s_time_details_layer, s_font30);
     text_layer_set_text_alignment(s_time_details_layer, GTextAlignmentCenter);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_time_details_layer));
+    layer_add_child(window_layer, text_layer_get_layer(s_time_details_layer));
 
     // Create day details TextLayer
     s_day_layer_bg = text_layer_create(GRect(0, 101, 144, 34));
-    text_layer_set_background_color(s_day_layer_bg, GColorBulgarianRose);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_day_layer_bg));
+    text_layer_set_background_color(s_day_layer_bg, COLOR_FALLBACK(GColorBulgarianRose, GColorBlack));
+    layer_add_child(window_layer, text_layer_get_layer(s_day_layer_bg));
 
     s_day_layer = text_layer_create(GRect(0, 101-6, 144, 34+2));
     text_layer_set_background_color(s_day_layer, GColorClear);
     text_layer_set_text_color(s_day_layer, GColorWhite);
     text_layer_set_font(s_day_layer, s_font30);
     text_layer_set_text_alignment(s_day_layer, GTextAlignmentCenter);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_day_layer));
+    layer_add_child(window_layer, text_layer_get_layer(s_day_layer));
 
     // Create steps TextLayer
     s_steps_layer = text_layer_create(GRect(0, 67-4, 144, 34*2+4));
     text_layer_set_background_color(s_steps_layer, GColorClear);
     text_layer_set_text_color(s_steps_layer, GColorWhite);
+#if PROFILE_STEPS_FONT
     text_layer_set_font(s_steps_layer, s_font54);
+#else
+    text_layer_set_font(s_steps_layer, s_font30);
+#endif
     text_layer_set_text_alignment(s_steps_layer, GTextAlignmentCenter);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_steps_layer));
+    layer_add_child(window_layer, text_layer_get_layer(s_steps_layer));
 
     // Create temp details TextLayer
     s_temp_layer_bg = text_layer_create(GRect(0, 135, 40, 33));
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_temp_layer_bg));
+    layer_add_child(window_layer, text_layer_get_layer(s_temp_layer_bg));
 
     s_temp_layer = text_layer_create(GRect(0, 135-6, 40, 33+2));
     text_layer_set_background_color(s_temp_layer, GColorClear);
     text_layer_set_text_color(s_temp_layer, GColorWhite);
     text_layer_set_font(s_temp_layer, s_font30);
     text_layer_set_text_alignment(s_temp_layer, GTextAlignmentCenter);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_temp_layer));
-
-    // Create weather icon layer
-    s_weather_layer = bitmap_layer_create(GRect(40, 135, 33, 33));
-    layer_add_child(window_get_root_layer(window), bitmap_layer_get_layer(s_weather_layer));
+    layer_add_child(window_layer, text_layer_get_layer(s_temp_layer));
 
     // Create alarm details TextLayer
     s_alarm_layer_bg = text_layer_create(GRect(73, 135, 144-73, 33));
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_alarm_layer_bg));
+    layer_add_child(window_layer, text_layer_get_layer(s_alarm_layer_bg));
 
     s_alarm_layer = text_layer_create(GRect(73, 135-6, 144-73, 33+2));
     text_layer_set_font(s_alarm_layer, s_font30);
     text_layer_set_background_color(s_alarm_layer, GColorClear);
     text_layer_set_text_alignment(s_alarm_layer, GTextAlignmentCenter);
-    layer_add_child(window_get_root_layer(window), text_layer_get_layer(s_alarm_layer));
+    layer_add_child(window_layer, text_layer_get_layer(s_alarm_layer));
+
+    // Display current time
+    time_t now = time(NULL);
+    struct tm *tick_time = localtime(&now);
+    display_time_or_steps(tick_time);
+
+    // Display what was known last time
+    update_alarm_time();
+    update_temp();
+}
+
+// Stage: weather icons and indicator layers
+static void load_icons() {
+    Layer *window_layer = window_get_root_layer(s_window);
+
+    for (uint i = 0; i < NUMBER_OF_WEATHER_ICONS; i++) {
+        s_weather_images[i] = gbitmap_create_with_resource(WEATHER_ICONS[i]);
+    }
+
+    // Create weather icon layer
+    s_weather_layer = bitmap_layer_create(GRect(40, 135, 33, 33));
+    layer_add_child(window_layer, bitmap_layer_get_layer(s_weather_layer));
 
     // Create battery layer THIS SHOULD BE AFTER OTHER TEXTS
     s_battery_layer = layer_create(GRect(0, 67, 144, 4));
     layer_set_update_proc(s_battery_layer, paint_battery_layer);
-    layer_add_child(window_get_root_layer(window), s_battery_layer);
+    layer_add_child(window_layer, s_battery_layer);
 
     // Create humidity layer THIS SHOULD BE AFTER OTHER TEXTS
     s_humidity_layer = layer_create(GRect(140, 0, 4, 168));
     layer_set_update_proc(s_humidity_layer, paint_humidity_layer);
-    layer_add_child(window_get_root_layer(window), s_humidity_layer);
+    layer_add_child(window_layer, s_humidity_layer);
 
     // Create bt layer: THIS SHOULD BE THE LAST LAYER
     s_bt_layer = layer_create(GRect(0, 0, 144, 168));
     layer_set_update_proc(s_bt_layer, paint_bt_layer);
-    layer_add_child(window_get_root_layer(window), s_bt_layer);
-
-    // Display current time
-    time_t now = time(NULL);
-    struct tm *tick_time = localtime(&now);
-    display_time_or_steps(tick_time);
+    layer_add_child(window_layer, s_bt_layer);
 
-    // Display some temp
-    update_alarm("", false);
-    update_temp();
     update_weather_icon();
+}
 
+// Stage: services
+static void load_services() {
     // Subscribe to time updates
     tick_timer_service_subscribe(MINUTE_UNIT, handle_minute_tick);
+    sched_use_minute_ticks(true);
 
     // Subscribe to the Battery State Service
     battery_state_service_subscribe(battery_handler);
@@ -687,78 +1164,154 @@ static void window_load(Window *window) {
     // Prepare alt mode
     show_default_mode();
 
+    // Worker answers with the latest step count
+    app_worker_message_subscribe(worker_message_handler);
+    AppWorkerMessage msg = {0};
+    app_worker_send_message(WORKER_MSG_STEPS, &msg);
+}
+
+// Stage: messaging stack
+static void load_messaging() {
     // This is important that this stuff is located HERE
     mq_init(inbox_received_callback);
+    mq_set_blob_receiver(s_forecast_blob, sizeof(s_forecast_blob), forecast_blob_received, NULL);
+
+    // Initial request, unless the snapshot is fresh enough
+    time_t now = time(NULL);
+    if (now >= s_next_fetch_secs) {
+        request_data();
+    }
+
+    check_heap_budget();
+}
+
+// Stage: real layers are all there, placeholder goes away
+static void drop_frame_snapshot() {
+    if (s_frame_snapshot_layer) {
+        destroy_layer(&s_frame_snapshot_layer);
+        window_set_background_color(s_window, GColorBlack);
+        layer_mark_dirty(window_get_root_layer(s_window));
+    }
+
+    request_frame_snapshot();
+}
+
+static const StartupStage s_startup_stages[] = {
+    { "clock", load_clock },
+    { "texts", load_texts },
+    { "icons", load_icons },
+    { "services", load_services },
+    { "messaging", load_messaging },
+    { "snapshot", drop_frame_snapshot }
+};
+
+// Heap is compared to this after unload. AppMessage buffers are left out,
+// they stay open once opened.
+static size_t heap_without_buffers() {
+    return heap_bytes_used() - mq_buffer_bytes();
+}
+
+static void check_heap_after_unload() {
+    size_t used = heap_without_buffers();
+
+    if (used > s_heap_before_load) {
+        APP_LOG(APP_LOG_LEVEL_WARNING, "Heap leak after unload: %u bytes",
+                (unsigned int)(used - s_heap_before_load));
+    } else {
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "Heap after unload: used=%u", (unsigned int)used);
+    }
+}
 
-    // Initial request
-    mq_add(CMD_OUT_GET_DATA, "");
+static void window_load(Window *window) {
+    s_heap_before_load = heap_without_buffers();
+    startup_run(s_startup_stages, ARRAY_LENGTH(s_startup_stages));
 }
 
+// Startup may be cancelled half way, so everything here must cope with
+// things that were never created
 static void window_unload(Window *window) {
+    startup_cancel();
+
     // Unsubscribe
+    app_worker_message_unsubscribe();
     tick_timer_service_unsubscribe();
+    sched_use_minute_ticks(false);
     battery_state_service_unsubscribe();
     bluetooth_connection_service_unsubscribe();
     accel_tap_service_unsubscribe();
 
-    // Destroy bitmaps
-    for (int i = 0; i < NUMBER_OF_IMAGES; i++) {
-        gbitmap_destroy(s_d_images[i]);
-        gbitmap_destroy(s_b_images[i]);
-    }
+    // Queued messages and their completions go away with the window
+    mq_deinit();
+    s_data_request = 0;
+    s_diagnostics_request = 0;
 
-    for (uint i = 0; i < NUMBER_OF_WEATHER_ICONS; i++) {
-        gbitmap_destroy(s_weather_images[i]);
+    // Pending tap window
+    if (s_bck_light_window_unset_task) {
+        sched_cancel(s_bck_light_window_unset_task);
+        s_bck_light_window_unset_task = NULL;
     }
+    s_bck_already_on = false;
 
-    if (s_ingress_slice_image1) {
-        gbitmap_destroy(s_ingress_slice_image1);
-        s_ingress_slice_image1 = NULL;
-    }
-    if (s_ingress_slice_image2) {
-        gbitmap_destroy(s_ingress_slice_image2);
-        s_ingress_slice_image2 = NULL;
+    if (s_frame_snapshot_task) {
+        sched_cancel(s_frame_snapshot_task);
+        s_frame_snapshot_task = NULL;
     }
+    s_frame_snapshot_due = false;
 
-    // Destroy layers
-    for (int i = 0; i < TOTAL_IMAGE_SLOTS; i++) {
-        layer_remove_from_parent(bitmap_layer_get_layer(s_image_layers[i]));
-        bitmap_layer_destroy(s_image_layers[i]);
-    }
+    // Animation holds bands on top of everything, so it goes first
+    stop_animation();
 
-    text_layer_destroy(s_time_details_layer);
-    text_layer_destroy(s_time_details_layer_bg);
-    text_layer_destroy(s_steps_layer);
-    text_layer_destroy(s_day_layer);
-    text_layer_destroy(s_day_layer_bg);
-    text_layer_destroy(s_alarm_layer);
-    text_layer_destroy(s_alarm_layer_bg);
-    text_layer_destroy(s_temp_layer);
-    text_layer_destroy(s_temp_layer_bg);
-    layer_destroy(s_battery_layer);
-    layer_destroy(s_humidity_layer);
-    layer_destroy(s_bt_layer);
-    bitmap_layer_destroy(s_weather_layer);
+    // Destroy bitmaps
+    digits_unload();
 
-    if (s_ingress_layer1) {
-        bitmap_layer_destroy(s_ingress_layer1);
-        s_ingress_layer1 = NULL;
+    for (uint i = 0; i < NUMBER_OF_WEATHER_ICONS; i++) {
+        destroy_bitmap(&s_weather_images[i]);
     }
 
-    if (s_ingress_layer2) {
-        bitmap_layer_destroy(s_ingress_layer2);
-        s_ingress_layer2 = NULL;
+    // Destroy layers
+    destroy_layer(&s_digits_layer);
+    destroy_text_layer(&s_time_details_layer);
+    destroy_text_layer(&s_time_details_layer_bg);
+    destroy_text_layer(&s_steps_layer);
+    destroy_text_layer(&s_day_layer);
+    destroy_text_layer(&s_day_layer_bg);
+    destroy_text_layer(&s_alarm_layer);
+    destroy_text_layer(&s_alarm_layer_bg);
+    destroy_text_layer(&s_temp_layer);
+    destroy_text_layer(&s_temp_layer_bg);
+    destroy_layer(&s_battery_layer);
+    destroy_layer(&s_humidity_layer);
+    destroy_layer(&s_bt_layer);
+    destroy_layer(&s_frame_snapshot_layer);
+    destroy_bitmap_layer(&s_weather_layer);
+
+    if (s_font30) {
+        fonts_unload_custom_font(s_font30);
+        s_font30 = NULL;
     }
 
-    fonts_unload_custom_font(s_font30);
-    fonts_unload_custom_font(s_font54);
+#if PROFILE_STEPS_FONT
+    if (s_font54) {
+        fonts_unload_custom_font(s_font54);
+        s_font54 = NULL;
+    }
+#endif
 
-    s_weather_layer = NULL;
-    s_temp_layer = NULL;
+    check_heap_after_unload();
 }
 
 static void init(void) {
-    s_last_temp_update_secs = time(NULL);
+    startup_begin();
+
+    // Steps and data fetch scheduling live in the background worker. It is
+    // launched only once: a worker stopped or replaced later in Settings stays
+    // that way, and the face reads health and fetches on its own.
+    if (!persist_exists(PERSIST_KEY_WORKER_LAUNCHED)) {
+        if (!app_worker_is_running()) {
+            app_worker_launch();
+        }
+        persist_write_bool(PERSIST_KEY_WORKER_LAUNCHED, true);
+    }
 
     // Create main Window element and assign to pointer
     s_window = window_create();
@@ -775,6 +1328,7 @@ static void init(void) {
 
 static void deinit(void) {
     window_destroy(s_window);
+    sched_deinit();
 }
 
 int main(void) {
@@ -0,0 +1,144 @@
+#include <pebble.h>
+#include "digits.h"
+
+// Layout of the resource, little endian:
+//   uint8 glyph count, uint8 width, uint8 height, uint8 reserved
+//   uint16 offset of every glyph from the start of the glyph data
+//   glyph data: one byte per run, runs of a row add up to width
+#define HEADER_SIZE 4
+#define LEVELS 4
+
+// Run byte: 2 bit level (0 = background, 3 = white) and 6 bit length - 1
+#define RUN_LEVEL(run) ((run) >> 6)
+#define RUN_LENGTH(run) (((run) & 0x3F) + 1)
+
+static uint8_t *s_data = NULL;
+static size_t s_size = 0;
+static uint8_t s_count = 0;
+static uint8_t s_width = 0;
+static uint8_t s_height = 0;
+
+static uint16_t glyph_offset(uint8_t glyph) {
+    const uint8_t *p = s_data + HEADER_SIZE + glyph * 2;
+    return p[0] | (p[1] << 8);
+}
+
+// Level blends background into white one 2 bit channel at a time,
+// 1-bit frame buffer only gets white for the upper half
+static void make_palette(uint8_t palette[LEVELS], GColor background, bool one_bit) {
+    for (int level = 0; level < LEVELS; level++) {
+        if (one_bit) {
+            palette[level] = level >= LEVELS / 2 || gcolor_equal(background, GColorWhite);
+            continue;
+        }
+
+        uint8_t argb = 0xC0;
+        for (int shift = 0; shift < 6; shift += 2) {
+            uint8_t c = (background.argb >> shift) & 3;
+            c += (3 - c) * level / (LEVELS - 1);
+            argb |= c << shift;
+        }
+        palette[level] = argb;
+    }
+}
+
+static void fill_span(uint8_t *row, bool one_bit, int16_t x, int16_t length, uint8_t color, int16_t row_width) {
+    if (x < 0) {
+        length += x;
+        x = 0;
+    }
+    if (x + length > row_width) {
+        length = row_width - x;
+    }
+    if (length <= 0) {
+        return;
+    }
+
+    if (!one_bit) {
+        memset(row + x, color, length);
+        return;
+    }
+
+    for (int16_t i = x; i < x + length; i++) {
+        if (color) {
+            row[i >> 3] |= 1 << (i & 7);
+        } else {
+            row[i >> 3] &= ~(1 << (i & 7));
+        }
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+bool digits_load(uint32_t resource_id) {
+    ResHandle handle = resource_get_handle(resource_id);
+    size_t size = resource_size(handle);
+
+    if (size < HEADER_SIZE) {
+        return false;
+    }
+
+    s_data = malloc(size);
+    if (!s_data) {
+        return false;
+    }
+
+    s_size = resource_load(handle, s_data, size);
+    s_count = s_data[0];
+    s_width = s_data[1];
+    s_height = s_data[2];
+
+    if (s_size < HEADER_SIZE + s_count * 2u) {
+        digits_unload();
+        return false;
+    }
+
+    return true;
+}
+
+void digits_unload(void) {
+    if (s_data) {
+        free(s_data);
+        s_data = NULL;
+    }
+
+    s_size = 0;
+    s_count = 0;
+}
+
+void digits_draw(GContext *ctx, GPoint origin, uint8_t glyph, GColor background) {
+    if (!s_data || glyph >= s_count) {
+        return;
+    }
+
+    GBitmap *fb = graphics_capture_frame_buffer(ctx);
+    if (!fb) {
+        return;
+    }
+
+    uint8_t *pixels = gbitmap_get_data(fb);
+    uint16_t stride = gbitmap_get_bytes_per_row(fb);
+    GRect bounds = gbitmap_get_bounds(fb);
+    bool one_bit = gbitmap_get_format(fb) == GBitmapFormat1Bit;
+
+    uint8_t palette[LEVELS];
+    make_palette(palette, background, one_bit);
+
+    const uint8_t *run = s_data + HEADER_SIZE + s_count * 2 + glyph_offset(glyph);
+    const uint8_t *end = s_data + s_size;
+
+    for (int16_t y = 0; y < s_height; y++) {
+        int16_t screen_y = origin.y + y;
+        uint8_t *row = screen_y >= 0 && screen_y < bounds.size.h ? pixels + screen_y * stride : NULL;
+
+        for (int16_t x = 0; x < s_width && run < end; run++) {
+            uint8_t length = RUN_LENGTH(*run);
+            if (row) {
+                fill_span(row, one_bit, origin.x + x, length, palette[RUN_LEVEL(*run)], bounds.size.w);
+            }
+            x += length;
+        }
+    }
+
+    graphics_release_frame_buffer(ctx, fb);
+}
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <pebble.h>
+
+// Clock digit glyphs kept run length encoded (see misc/digits2rle.py)
+// and decoded straight into the frame buffer, so no decoded bitmaps are
+// held. Glyphs have anti-aliased white shape over the given background.
+
+bool digits_load(uint32_t resource_id);
+void digits_unload(void);
+
+// Origin is in screen coordinates. Must be called from a layer update proc.
+void digits_draw(GContext *ctx, GPoint origin, uint8_t glyph, GColor background);
@@ -0,0 +1,82 @@
+#include <pebble.h>
+#include "forecast.h"
+
+#define HOUR_SECS (60 * 60)
+
+typedef struct {
+    time_t start; // beginning of the hour in entries[head]
+    uint8_t head;
+    uint8_t count;
+    ForecastHour entries[FORECAST_MAX_HOURS];
+} ForecastRing;
+
+static ForecastRing s_ring = {0};
+
+// Drop hours that are completely in the past
+static void advance(time_t now) {
+    while (s_ring.count && s_ring.start + HOUR_SECS <= now) {
+        s_ring.head = (s_ring.head + 1) % FORECAST_MAX_HOURS;
+        s_ring.count -= 1;
+        s_ring.start += HOUR_SECS;
+    }
+}
+
+void forecast_set(time_t start, const uint8_t *packed, uint16_t length) {
+    uint16_t count = length / FORECAST_PACKED_ENTRY_SIZE;
+    if (count > FORECAST_MAX_HOURS) {
+        count = FORECAST_MAX_HOURS;
+    }
+
+    s_ring.start = start - start % HOUR_SECS;
+    s_ring.head = 0;
+    s_ring.count = count;
+
+    for (int i = 0; i < count; i++) {
+        const uint8_t *p = packed + i * FORECAST_PACKED_ENTRY_SIZE;
+        s_ring.entries[i] = (ForecastHour) {
+            .temp = (int8_t)p[0],
+            .icon = p[1],
+            .hum = p[2]
+        };
+    }
+}
+
+void forecast_clear(void) {
+    s_ring.count = 0;
+}
+
+bool forecast_lookup(time_t now, ForecastHour *hour) {
+    advance(now);
+
+    if (!s_ring.count || now < s_ring.start) {
+        return false;
+    }
+
+    *hour = s_ring.entries[s_ring.head];
+    return true;
+}
+
+uint8_t forecast_hours_left(time_t now) {
+    advance(now);
+    return s_ring.count;
+}
+
+time_t forecast_end(void) {
+    return s_ring.start + s_ring.count * HOUR_SECS;
+}
+
+void forecast_load(uint32_t persist_key) {
+    ForecastRing ring;
+    if (persist_read_data(persist_key, &ring, sizeof(ring)) == sizeof(ring)
+            && ring.count <= FORECAST_MAX_HOURS && ring.head < FORECAST_MAX_HOURS) {
+        s_ring = ring;
+    }
+}
+
+void forecast_save(uint32_t persist_key) {
+    if (s_ring.count) {
+        persist_write_data(persist_key, &s_ring, sizeof(s_ring));
+    } else {
+        persist_delete(persist_key);
+    }
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <pebble.h>
+
+// Hourly forecast received in one batch and kept in a small ring.
+// Hours that are over are dropped from the head as time goes on.
+
+#define FORECAST_MAX_HOURS 24
+
+// Packed entry on the wire: temp (int8), condition (uint8), humidity (uint8)
+#define FORECAST_PACKED_ENTRY_SIZE 3
+
+typedef struct {
+    int8_t temp;
+    int8_t icon;
+    int8_t hum;
+} ForecastHour;
+
+void forecast_set(time_t start, const uint8_t *packed, uint16_t length);
+void forecast_clear(void);
+bool forecast_lookup(time_t now, ForecastHour *hour);
+uint8_t forecast_hours_left(time_t now);
+time_t forecast_end(void);
+
+void forecast_load(uint32_t persist_key);
+void forecast_save(uint32_t persist_key);
@@ -0,0 +1,321 @@
+#include <pebble.h>
+#include "frame-snapshot.h"
+#include "snapshot.h"
+#include "utils.h"
+
+// PackBits: header 0..127 is followed by header + 1 literal bytes,
+// header 129..255 by one byte repeated 257 - header times
+#define MAX_LITERAL 128
+#define MAX_REPEAT 128
+
+// Every row is XORed with the row above before it is compressed, so what
+// doesn't change from row to row (backgrounds, vertical strokes) turns into
+// runs of zeroes. First row of the region is kept as is.
+
+typedef struct {
+    uint8_t format;      // GBitmapFormat of the frame buffer
+    uint8_t chunk_count; // must stay the second byte, stale chunks are found by it
+    uint16_t stride;
+    uint16_t top;        // first row of the region
+    uint16_t height;     // rows in the region
+    uint16_t length;     // compressed bytes in all chunks
+    uint32_t hash;       // of the uncompressed region
+} FrameHeader;
+
+typedef struct {
+    uint8_t *buf; // PERSIST_DATA_MAX_LENGTH bytes on the heap
+    uint16_t used;
+    uint16_t length;
+    uint8_t chunk_count;
+    bool overflow;
+    bool failed;  // persist write failed, chunks written so far are useless
+    bool dry_run; // only count, nothing is written
+} ChunkWriter;
+
+typedef struct {
+    uint8_t *buf; // PERSIST_DATA_MAX_LENGTH bytes on the heap
+    uint16_t used;
+    uint16_t pos;
+    uint8_t chunk;
+    uint8_t chunk_count;
+} ChunkReader;
+
+// Hash of the region last saved or found too big, it is not tried again
+static uint32_t s_last_hash = 0;
+
+static uint32_t hash_region(const uint8_t *data, uint32_t size) {
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < size; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline uint8_t filtered(const uint8_t *data, uint16_t stride, uint32_t i) {
+    return i < stride ? data[i] : data[i] ^ data[i - stride];
+}
+
+static bool read_header(FrameHeader *header) {
+    return persist_read_data(PERSIST_KEY_FRAME, header, sizeof(FrameHeader)) == sizeof(FrameHeader)
+        && header->chunk_count <= FRAME_SNAPSHOT_MAX_CHUNKS;
+}
+
+// Chunk count of whatever is stored, a header of an older build included.
+// Without a header nothing tells how many chunks are there, all are checked.
+static uint8_t stored_chunk_count() {
+    FrameHeader header = {0};
+    int read = persist_read_data(PERSIST_KEY_FRAME, &header, sizeof(header));
+    return read >= 2 ? header.chunk_count : FRAME_SNAPSHOT_MAX_CHUNKS;
+}
+
+static void delete_chunks(uint8_t from, uint8_t to) {
+    for (uint8_t n = from; n < to; n++) {
+        persist_delete(PERSIST_KEY_FRAME_CHUNKS + n);
+    }
+}
+
+static void flush_chunk(ChunkWriter *w) {
+    if (!w->used || w->overflow || w->failed) {
+        return;
+    }
+
+    if (w->chunk_count >= FRAME_SNAPSHOT_MAX_CHUNKS) {
+        w->overflow = true;
+        return;
+    }
+
+    if (!w->dry_run && persist_write_data(PERSIST_KEY_FRAME_CHUNKS + w->chunk_count, w->buf, w->used) != w->used) {
+        w->failed = true;
+        return;
+    }
+    w->chunk_count += 1;
+    w->length += w->used;
+    w->used = 0;
+}
+
+static void put_byte(ChunkWriter *w, uint8_t byte) {
+    if (w->overflow || w->failed) {
+        return;
+    }
+
+    w->buf[w->used++] = byte;
+    if (w->used == PERSIST_DATA_MAX_LENGTH) {
+        flush_chunk(w);
+    }
+}
+
+static void compress(ChunkWriter *w, const uint8_t *data, uint16_t stride, uint32_t size) {
+    uint32_t i = 0;
+
+    while (i < size && !w->overflow && !w->failed) {
+        uint8_t byte = filtered(data, stride, i);
+        uint32_t run = 1;
+        while (i + run < size && run < MAX_REPEAT && filtered(data, stride, i + run) == byte) {
+            run++;
+        }
+
+        if (run >= 3) {
+            put_byte(w, 257 - run);
+            put_byte(w, byte);
+            i += run;
+            continue;
+        }
+
+        // Literals until the next run worth encoding
+        uint32_t start = i;
+        while (i < size && i - start < MAX_LITERAL) {
+            if (i + 2 < size && filtered(data, stride, i) == filtered(data, stride, i + 1)
+                    && filtered(data, stride, i) == filtered(data, stride, i + 2)) {
+                break;
+            }
+            i++;
+        }
+
+        put_byte(w, i - start - 1);
+        for (uint32_t j = start; j < i; j++) {
+            put_byte(w, filtered(data, stride, j));
+        }
+    }
+
+    flush_chunk(w);
+}
+
+// Returns -1 once all chunks are consumed
+static int16_t next_byte(ChunkReader *r) {
+    if (r->pos == r->used) {
+        if (r->chunk == r->chunk_count) {
+            return -1;
+        }
+
+        int read = persist_read_data(PERSIST_KEY_FRAME_CHUNKS + r->chunk, r->buf, PERSIST_DATA_MAX_LENGTH);
+        r->chunk += 1;
+        r->pos = 0;
+        r->used = read > 0 ? read : 0;
+
+        if (!r->used) {
+            return -1;
+        }
+    }
+
+    return r->buf[r->pos++];
+}
+
+// Undoes the row filter as it goes, the row above is already in place
+static inline void put_pixel_byte(uint8_t *data, uint16_t stride, uint32_t pos, uint8_t byte) {
+    data[pos] = pos < stride ? byte : byte ^ data[pos - stride];
+}
+
+static uint32_t decompress(ChunkReader *r, uint8_t *data, uint16_t stride, uint32_t size) {
+    uint32_t pos = 0;
+
+    while (pos < size) {
+        int16_t h = next_byte(r);
+        if (h < 0) {
+            break;
+        }
+
+        if (h < MAX_LITERAL) {
+            for (int16_t n = h + 1; n > 0 && pos < size; n--) {
+                int16_t byte = next_byte(r);
+                if (byte < 0) {
+                    return pos;
+                }
+                put_pixel_byte(data, stride, pos++, byte);
+            }
+        } else if (h > MAX_LITERAL) {
+            int16_t byte = next_byte(r);
+            if (byte < 0) {
+                break;
+            }
+            for (int16_t n = 257 - h; n > 0 && pos < size; n--) {
+                put_pixel_byte(data, stride, pos++, byte);
+            }
+        }
+    }
+
+    return pos;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+bool frame_snapshot_exists(void) {
+    FrameHeader header;
+    return read_header(&header);
+}
+
+bool frame_snapshot_draw(GContext *ctx) {
+    FrameHeader header;
+    if (!read_header(&header)) {
+        return false;
+    }
+
+    GBitmap *fb = graphics_capture_frame_buffer(ctx);
+    if (!fb) {
+        return false;
+    }
+
+    uint32_t start_ms = now_ms();
+    uint16_t stride = gbitmap_get_bytes_per_row(fb);
+    uint32_t size = header.stride * header.height;
+    uint32_t pos = 0;
+
+    // Saved by a different platform or build, nothing to show
+    if (header.format != gbitmap_get_format(fb) || header.stride != stride
+            || header.top + header.height > gbitmap_get_bounds(fb).size.h) {
+        graphics_release_frame_buffer(ctx, fb);
+        return false;
+    }
+
+    ChunkReader reader = {
+        .buf = malloc(PERSIST_DATA_MAX_LENGTH),
+        .chunk_count = header.chunk_count
+    };
+
+    if (reader.buf) {
+        pos = decompress(&reader, gbitmap_get_data(fb) + header.top * stride, stride, size);
+        s_last_hash = header.hash;
+        free(reader.buf);
+    }
+
+    graphics_release_frame_buffer(ctx, fb);
+
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Frame snapshot drawn: %u bytes in %u ms",
+            header.length, (unsigned int)(now_ms() - start_ms));
+
+    return pos == size;
+}
+
+// Compressed twice: first only to see if it fits, so a frame that
+// doesn't fit costs no flash writes and leaves the old one in place
+bool frame_snapshot_save(GContext *ctx, uint16_t top) {
+    GBitmap *fb = graphics_capture_frame_buffer(ctx);
+    if (!fb) {
+        return false;
+    }
+
+    uint32_t start_ms = now_ms();
+    uint8_t format = gbitmap_get_format(fb);
+    uint16_t stride = gbitmap_get_bytes_per_row(fb);
+    uint16_t height = gbitmap_get_bounds(fb).size.h - top;
+    const uint8_t *data = gbitmap_get_data(fb) + top * stride;
+    uint32_t size = stride * height;
+    uint32_t hash = hash_region(data, size);
+
+    if (hash == s_last_hash) {
+        graphics_release_frame_buffer(ctx, fb);
+        return false;
+    }
+
+    ChunkWriter writer = {
+        .buf = malloc(PERSIST_DATA_MAX_LENGTH),
+        .dry_run = true
+    };
+    if (!writer.buf) {
+        graphics_release_frame_buffer(ctx, fb);
+        return false;
+    }
+
+    s_last_hash = hash;
+    compress(&writer, data, stride, size);
+
+    uint8_t chunk_count = writer.chunk_count;
+    bool saved = !writer.overflow;
+    if (saved) {
+        // Header goes last, so a half written frame is never used.
+        // Chunks the new frame doesn't need would hold the quota for nothing.
+        uint8_t stale = stored_chunk_count();
+        persist_delete(PERSIST_KEY_FRAME);
+        delete_chunks(chunk_count, stale);
+
+        writer = (ChunkWriter) {
+            .buf = writer.buf
+        };
+        compress(&writer, data, stride, size);
+
+        FrameHeader header = {
+            .format = format,
+            .chunk_count = writer.chunk_count,
+            .stride = stride,
+            .top = top,
+            .height = height,
+            .length = writer.length,
+            .hash = hash
+        };
+
+        saved = !writer.failed && persist_write_data(PERSIST_KEY_FRAME, &header, sizeof(header)) == sizeof(header);
+        if (!saved) {
+            // Out of storage, whatever got written is useless without the header
+            delete_chunks(0, chunk_count);
+            s_last_hash = 0;
+        }
+    }
+
+    free(writer.buf);
+    graphics_release_frame_buffer(ctx, fb);
+
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Frame snapshot %s: %u bytes, %u chunks, %u ms",
+            saved ? "saved" : writer.overflow ? "too big" : "failed",
+            writer.length, writer.chunk_count, (unsigned int)(now_ms() - start_ms));
+
+    return saved;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <pebble.h>
+
+// Last rendered frame kept in persistent storage, so it can be shown as
+// a placeholder on the next launch before the real layers are ready.
+// Only rows from top down are kept, what is above is drawn right away anyway.
+// Rows are delta filtered, PackBits compressed and split across
+// PERSIST_KEY_FRAME_CHUNKS.
+
+// Together with the other keys this must stay within 4 KB per app.
+// Rows below the clock digits take 0.7-1.0 KB on aplite and 1.2-2.5 KB
+// on basalt, see tests/test-frame-snapshot.c.
+#define FRAME_SNAPSHOT_MAX_CHUNKS 12
+
+bool frame_snapshot_exists(void);
+
+// Both must be called from a layer update proc. Save captures whatever is
+// in the frame buffer at that point, so call it from the topmost layer.
+// Draw decodes straight into the frame buffer, which keeps it only as long
+// as nothing else paints there, e.g. with a GColorClear window background.
+bool frame_snapshot_draw(GContext *ctx);
+bool frame_snapshot_save(GContext *ctx, uint16_t top);
@@ -5,33 +5,119 @@
 
 #include <pebble.h>
 #include "message-queue.h"
+#include "profile.h"
 #include "utils.h"
+#include "scheduler.h"
 
 #define ATTEMPT_COUNT 4
 #define MSG_UUID_HIST_LEN 20
-#define CMD_OUT_ACK 8
+#define ACK_TTL_SECS 60
+#define ACK_DELAY_MS 200
+#define ACK_DELAY_SLACK_MS 300
+#define SEND_GAP_MS 500
+#define SEND_GAP_SLACK_MS 250
+#define MAX_PENDING_ACKS 8
+#define FRAG_GAP_MS 50
+#define FRAG_GAP_SLACK_MS 50
+
+// Same as dict_calc_buffer_size: one byte header plus key, type and length per tuple
+#define DICT_HEADER_SIZE 1
+#define DICT_TUPLE_SIZE(value_size) (7 + (value_size))
+#define DECIMAL_SIZE 11 // "4294967295" and the terminator
+
+// Everything in a fragment but its data and ACKs, worst case
+#define FRAG_MAX_OVERHEAD (DICT_HEADER_SIZE \
+    + DICT_TUPLE_SIZE(1)                              /* cmd */ \
+    + MQ_MAX_FIELDS * DICT_TUPLE_SIZE(DECIMAL_SIZE)   /* fields */ \
+    + DICT_TUPLE_SIZE(4)                              /* uuid */ \
+    + DICT_TUPLE_SIZE(1)                              /* proto */ \
+    + DICT_TUPLE_SIZE(1)                              /* empty data string of legacy peers */ \
+    + DICT_TUPLE_SIZE(4)                              /* fragment id */ \
+    + 3 * DICT_TUPLE_SIZE(2)                          /* seq, offset, total */ \
+    + DICT_TUPLE_SIZE(0))                             /* fragment data header */
+
+#if PROFILE_OUTBOX_SIZE < FRAG_MAX_OVERHEAD + MQ_FRAG_MIN_DATA
+#error "Outbox is too small for fragments of MQ_FRAG_MIN_DATA bytes"
+#endif
 
 typedef struct MessageQueue MessageQueue;
 struct MessageQueue {
     MessageQueue* next;
-    uint8_t cmd;
-    char* data;
+    MqRecord record;
     uint32_t uuid;
     uint8_t attempts_left;
+    uint8_t priority;
+    time_t expires_at;
+    MqHandle handle;
+    uint32_t submitted_ms;
+    MqCompletion completion;
+    void* context;
+
+    // Payload sent in fragments, owned by the caller
+    const uint8_t* blob;
+    uint16_t blob_length;
+    uint16_t blob_offset;
+    uint16_t blob_seq;
+    uint16_t blob_frag_length; // length of the fragment in the outbox
 };
 
-static void destroy_message_queue(MessageQueue* queue);
+// Reassembly of incoming fragments into the caller supplied buffer
+typedef struct {
+    uint8_t* buffer;
+    uint16_t capacity;
+    MqBlobHandler handler;
+    void* context;
+
+    bool active;
+    uint32_t id;
+    uint16_t next_seq;
+    uint16_t received;
+    uint16_t total;
+} BlobReceiver;
+
+static MqHandle enqueue(const MqRecord* record, const MqOptions* options, const uint8_t* blob, uint16_t blob_length);
+static void finish_message(MessageQueue* prev, MessageQueue* mq, MqStatus status);
+static void purge_expired();
+static bool reserve_slot(uint8_t priority);
+static bool has_field(const MqRecord* record, uint8_t key);
+static void write_record(DictionaryIterator* dict, const MqRecord* record);
 static void outbox_sent_callback(DictionaryIterator *iterator, void *context);
 static void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResult reason, void *context);
 static void inbox_received_callback(DictionaryIterator *iterator, void *context);
 static void send_next_message();
 static void send_timer_callback(void* context);
+static void ack_timer_callback(void* context);
+static void remember_ack(uint32_t uuid);
+static void schedule_standalone_ack();
+static void schedule_send(uint32_t delay_ms, uint32_t slack_ms);
+static bool in_flight(const MessageQueue* prev, const MessageQueue* mq);
+static uint8_t fragment_ack_count(const MessageQueue* mq);
+static bool advance_blob(MessageQueue* mq);
+static void write_fragment(DictionaryIterator* dict, MessageQueue* mq, uint8_t ack_count);
+static void receive_fragment(DictionaryIterator* iterator, uint8_t cmd);
 static char *translate_error(AppMessageResult result);
 
 static MessageHandler message_handler;
+static bool buffers_open = false;
+static size_t buffer_bytes = 0;
 static MessageQueue* msg_queue = NULL;
 static bool sending = false;
 static bool can_send = false;
+static uint16_t queue_bytes = 0;
+static MqStats stats = {0};
+static MqHandle last_handle = 0;
+static uint8_t consecutive_failures = 0;
+static uint8_t peer_proto = MQ_PROTO_LEGACY;
+
+// ACKs are piggybacked on whatever goes out next. The first in_flight_ack_count
+// entries are in the outbox right now and are forgotten once it is delivered.
+static uint32_t pending_acks[MAX_PENDING_ACKS];
+static uint8_t pending_ack_count = 0;
+static uint8_t in_flight_ack_count = 0;
+static SchedTask* ack_task = NULL;
+static SchedTask* send_task = NULL;
+
+static BlobReceiver blob_receiver = {0};
 
 static uint32_t msg_uuid_hist[MSG_UUID_HIST_LEN] = {0};
 static int8_t msg_uuid_hist_pos = 0;
@@ -43,8 +129,12 @@ void mq_init(MessageHandler handler) {
 
     // It's important to use some OK amount to avoid
     // using too much memory....
-    app_message_open(512, 768);
-
+    if (!buffers_open) {
+        size_t heap_before = heap_bytes_used();
+        app_message_open(PROFILE_INBOX_SIZE, PROFILE_OUTBOX_SIZE);
+        buffer_bytes = heap_bytes_used() - heap_before;
+        buffers_open = true;
+    }
 
     app_message_register_outbox_sent(outbox_sent_callback);
     app_message_register_outbox_failed(outbox_failed_callback);
@@ -56,54 +146,203 @@ void mq_init(MessageHandler handler) {
     APP_LOG(APP_LOG_LEVEL_DEBUG, "MQ init done");
 }
 
-bool mq_add(uint8_t cmd, char* data) {
+void mq_deinit(void) {
+    app_message_deregister_callbacks();
+    can_send = false;
+    sending = false;
+
+    while (msg_queue) {
+        MessageQueue* mq = msg_queue;
+        msg_queue = mq->next;
+        free(mq);
+    }
+    queue_bytes = 0;
+
+    sched_cancel(send_task);
+    send_task = NULL;
+    sched_cancel(ack_task);
+    ack_task = NULL;
+
+    pending_ack_count = 0;
+    in_flight_ack_count = 0;
+    consecutive_failures = 0;
+    peer_proto = MQ_PROTO_LEGACY;
+    blob_receiver = (BlobReceiver) {0};
+    message_handler = NULL;
+
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "MQ deinit done");
+}
+
+size_t mq_buffer_bytes(void) {
+    return buffer_bytes;
+}
+
+bool mq_add_record(const MqRecord* record, MqPriority priority, uint16_t ttl_secs) {
+    MqOptions options = {
+        .priority = priority,
+        .ttl_secs = ttl_secs
+    };
+
+    return mq_submit(record, &options) != 0;
+}
+
+MqHandle mq_submit(const MqRecord* record, const MqOptions* options) {
+    return enqueue(record, options, NULL, 0);
+}
+
+MqHandle mq_submit_blob(const MqRecord* record, const uint8_t* data, uint16_t length, const MqOptions* options) {
+    if (!data || !length) {
+        return 0;
+    }
+
+    return enqueue(record, options, data, length);
+}
+
+void mq_set_blob_receiver(uint8_t* buffer, uint16_t capacity, MqBlobHandler handler, void* context) {
+    blob_receiver = (BlobReceiver) {
+        .buffer = buffer,
+        .capacity = capacity,
+        .handler = handler,
+        .context = context
+    };
+}
+
+static MqHandle enqueue(const MqRecord* record, const MqOptions* options, const uint8_t* blob, uint16_t blob_length) {
+    MqPriority priority = options->priority;
+
+    purge_expired();
+
+    if (!reserve_slot(priority)) {
+        stats.dropped += 1;
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "DROP NEW: %u", record->cmd);
+        return 0;
+    }
+
     MessageQueue* mq = malloc(sizeof(MessageQueue));
     mq->next = NULL;
     mq->attempts_left = ATTEMPT_COUNT;
-    mq->data = strdup(data);
-    mq->cmd = cmd;
+    mq->record = *record;
     mq->uuid = rand();
+    mq->priority = priority;
+    mq->expires_at = time(NULL) + options->ttl_secs;
+    mq->submitted_ms = now_ms();
+    mq->completion = options->completion;
+    mq->context = options->context;
+    mq->blob = blob;
+    mq->blob_length = blob_length;
+    mq->blob_offset = 0;
+    mq->blob_seq = 0;
+    mq->blob_frag_length = 0;
+
+    last_handle += 1;
+    if (!last_handle) {
+        last_handle = 1;
+    }
+    mq->handle = last_handle;
+
+    if (mq->record.field_count > MQ_MAX_FIELDS) {
+        mq->record.field_count = MQ_MAX_FIELDS;
+    }
+
+    queue_bytes += sizeof(MessageQueue);
+
+    // Skip everything with the same or higher priority. Message in flight is never preempted.
+    MessageQueue* prev = NULL;
+    MessageQueue* cur = msg_queue;
+    while (cur != NULL && (cur->priority <= priority || in_flight(prev, cur))) {
+        prev = cur;
+        cur = cur->next;
+    }
 
-    if (msg_queue == NULL) {
+    mq->next = cur;
+    if (prev == NULL) {
         msg_queue = mq;
     } else {
-        MessageQueue* eoq = msg_queue;
-        while (eoq->next != NULL) {
-            eoq = eoq->next;
-        }
-        eoq->next = mq;
+        prev->next = mq;
     }
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "ADD: %u, %u, %s", cmd, (unsigned int)(mq->uuid), data);
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "ADD: %u, %u, %u", record->cmd, (unsigned int)(mq->uuid), priority);
+
+    MqHandle handle = mq->handle;
 
     send_next_message();
 
-    return true;
+    return handle;
+}
+
+MqPressure mq_pressure(void) {
+    uint16_t fill = queue_bytes * 100 / MQ_MAX_BYTES;
+
+    // Failures only count while something waits for the link. Once the queue
+    // is empty the next message goes out as a probe, nothing else would
+    // find out that the link is back.
+    uint8_t failures = msg_queue ? consecutive_failures : 0;
+
+    if (fill >= 75 || failures >= ATTEMPT_COUNT) {
+        return MQ_PRESSURE_SATURATED;
+    }
+
+    if (fill >= 50 || failures > 0) {
+        return MQ_PRESSURE_HIGH;
+    }
+
+    return MQ_PRESSURE_NONE;
+}
+
+void mq_get_stats(MqStats* out) {
+    *out = stats;
 }
 
 // - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
 
 static void outbox_sent_callback(DictionaryIterator *iterator, void *context) {
+    // Message sent before the last mq_deinit, not ours anymore
+    if (!sending) {
+        return;
+    }
+
     sending = false;
+    consecutive_failures = 0;
+
+    // Forget ACKs that were delivered with this message
+    pending_ack_count -= in_flight_ack_count;
+    memmove(pending_acks, pending_acks + in_flight_ack_count, pending_ack_count * sizeof(uint32_t));
+    in_flight_ack_count = 0;
 
     MessageQueue* sent = msg_queue;
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "SENT: %u, %u, %s", (unsigned int)(sent->cmd), (unsigned int)(sent->uuid), sent->data);
-    msg_queue = msg_queue->next;
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "SENT: %u, %u", (unsigned int)(sent->record.cmd), (unsigned int)(sent->uuid));
 
-    destroy_message_queue(sent);
+    // Message stays at the head until its last fragment is delivered
+    if (advance_blob(sent)) {
+        schedule_send(FRAG_GAP_MS, FRAG_GAP_SLACK_MS);
+        return;
+    }
+
+    finish_message(NULL, sent, MQ_STATUS_DELIVERED);
 
     if (msg_queue) {
-        app_timer_register(500, send_timer_callback, NULL);
+        schedule_send(SEND_GAP_MS, SEND_GAP_SLACK_MS);
+    } else if (pending_ack_count) {
+        schedule_standalone_ack();
     }
 }
 
 static void outbox_failed_callback(DictionaryIterator *iterator, AppMessageResult reason, void *context) {
+    if (!sending) {
+        return;
+    }
+
     sending = false;
+    in_flight_ack_count = 0;
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "ERROR: %u, %u, %s", (unsigned int)(msg_queue->cmd), (unsigned int)(msg_queue->uuid), msg_queue->data);
+    if (consecutive_failures < 0xFF) {
+        consecutive_failures += 1;
+    }
+
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "ERROR: %u, %u", (unsigned int)(msg_queue->record.cmd), (unsigned int)(msg_queue->uuid));
     APP_LOG(APP_LOG_LEVEL_DEBUG, "%s", translate_error(reason));
 
-    app_timer_register(500, send_timer_callback, NULL);
+    schedule_send(SEND_GAP_MS, SEND_GAP_SLACK_MS);
 }
 
 static void inbox_received_callback(DictionaryIterator *iterator, void *context) {
@@ -117,8 +356,31 @@ static void inbox_received_callback(DictionaryIterator *iterator, void *context)
         return; // uuid is missing
     }
 
-    // Send ACK
-    mq_fmt(CMD_OUT_ACK, 15, "%lu", uuid);
+    Tuple* proto_tuple = dict_find(iterator, MSG_KEY_PROTO);
+    peer_proto = proto_tuple ? proto_tuple->value->uint8 : MQ_PROTO_LEGACY;
+
+    if (peer_proto == MQ_PROTO_LEGACY) {
+        // Legacy peer only understands one ACK message per received message
+        MqRecord ack = {
+            .cmd = MQ_CMD_OUT_ACK,
+            .field_count = 1,
+            .fields = {
+                { .key = MSG_KEY_DATA, .type = MQ_FIELD_DECIMAL, .value = uuid }
+            }
+        };
+        mq_add_record(&ack, MQ_PRIORITY_CONTROL, ACK_TTL_SECS);
+    } else {
+        // ACK goes with the next outgoing message or standalone if there is none soon.
+        // A send that is already scheduled keeps its time, otherwise the usual gap applies.
+        remember_ack(uuid);
+        if (msg_queue) {
+            if (!sending && !send_task) {
+                schedule_send(SEND_GAP_MS, SEND_GAP_SLACK_MS);
+            }
+        } else if (!sending) {
+            schedule_standalone_ack();
+        }
+    }
 
     // Check UUID
     for (int i = 0; i < MSG_UUID_HIST_LEN; i++) {
@@ -131,13 +393,86 @@ static void inbox_received_callback(DictionaryIterator *iterator, void *context)
     msg_uuid_hist[msg_uuid_hist_pos] = uuid;
     msg_uuid_hist_pos = (msg_uuid_hist_pos + 1) % MSG_UUID_HIST_LEN;
 
+    // Fragments are only handed over once the payload is complete
+    if (dict_find(iterator, MSG_KEY_FRAG_DATA)) {
+        Tuple* cmd_tuple = dict_find(iterator, MSG_KEY_CMD);
+        receive_fragment(iterator, cmd_tuple ? cmd_tuple->value->uint8 : 0);
+        return;
+    }
+
     // Do something useful
     message_handler(iterator);
 }
 
-static void destroy_message_queue(MessageQueue* queue) {
-    free(queue->data);
-    free(queue);
+// Unlinks and frees message before the completion is called,
+// so the callback sees a consistent queue
+static void finish_message(MessageQueue* prev, MessageQueue* mq, MqStatus status) {
+    if (prev == NULL) {
+        msg_queue = mq->next;
+    } else {
+        prev->next = mq->next;
+    }
+
+    queue_bytes -= sizeof(MessageQueue);
+
+    MqCompletion completion = mq->completion;
+    void* context = mq->context;
+    MqHandle handle = mq->handle;
+    uint32_t latency_ms = now_ms() - mq->submitted_ms;
+
+    free(mq);
+
+    if (completion) {
+        completion(handle, status, latency_ms, context);
+    }
+}
+
+static void purge_expired() {
+    time_t now = time(NULL);
+
+    // Start over after every removal, completion callback may have changed the queue
+    bool removed = true;
+    while (removed) {
+        removed = false;
+
+        MessageQueue* prev = NULL;
+        for (MessageQueue* mq = msg_queue; mq != NULL; prev = mq, mq = mq->next) {
+            if (!in_flight(prev, mq) && mq->expires_at <= now) {
+                APP_LOG(APP_LOG_LEVEL_DEBUG, "EXPIRED: %u, %u", (unsigned int)(mq->record.cmd), (unsigned int)(mq->uuid));
+                stats.expired += 1;
+                finish_message(prev, mq, MQ_STATUS_EXPIRED);
+                removed = true;
+                break;
+            }
+        }
+    }
+}
+
+// Evicts the oldest message of the lowest priority until one more message fits in MQ_MAX_BYTES.
+// Gives up if everything left is more important than the new message.
+static bool reserve_slot(uint8_t priority) {
+    while (queue_bytes + sizeof(MessageQueue) > MQ_MAX_BYTES) {
+        MessageQueue* victim = NULL;
+        MessageQueue* victim_prev = NULL;
+
+        MessageQueue* prev = NULL;
+        for (MessageQueue* mq = msg_queue; mq != NULL; prev = mq, mq = mq->next) {
+            if (!in_flight(prev, mq) && (victim == NULL || mq->priority > victim->priority)) {
+                victim = mq;
+                victim_prev = prev;
+            }
+        }
+
+        if (victim == NULL || victim->priority < priority) {
+            return false;
+        }
+
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "EVICT: %u, %u", (unsigned int)(victim->record.cmd), (unsigned int)(victim->uuid));
+        stats.dropped += 1;
+        finish_message(victim_prev, victim, MQ_STATUS_DROPPED);
+    }
+
+    return true;
 }
 
 static void send_next_message() {
@@ -145,37 +480,257 @@ static void send_next_message() {
         return;
     }
 
+    if (sending) {
+        return;
+    }
+
+    purge_expired();
+
     MessageQueue* mq = msg_queue;
     if (!mq) {
         return;
     }
 
-    APP_LOG(APP_LOG_LEVEL_DEBUG, "SENDING: %u, %u, %s", (unsigned int)(mq->cmd), (unsigned int)(mq->uuid), mq->data);
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "SENDING: %u, %u", (unsigned int)(mq->record.cmd), (unsigned int)(mq->uuid));
 
     if (mq->attempts_left <= 0) {
-        msg_queue = mq->next;
-        destroy_message_queue(mq);
+        stats.failed += 1;
+        finish_message(NULL, mq, MQ_STATUS_FAILED);
         send_next_message();
         return;
     }
 
-    if (sending) {
+    // Outbox may still hold a message sent before the last mq_deinit
+    DictionaryIterator* dict;
+    AppMessageResult begin = app_message_outbox_begin(&dict);
+    if (begin != APP_MSG_OK) {
+        APP_LOG(APP_LOG_LEVEL_DEBUG, "OUTBOX: %s", translate_error(begin));
+        schedule_send(SEND_GAP_MS, SEND_GAP_SLACK_MS);
         return;
     }
 
     sending = true;
 
-    DictionaryIterator* dict;
-    app_message_outbox_begin(&dict);
-    dict_write_uint8(dict, MSG_KEY_CMD, mq->cmd);
-    dict_write_cstring(dict, MSG_KEY_DATA, mq->data);
+    write_record(dict, &mq->record);
     dict_write_uint32(dict, MSG_KEY_UUID, mq->uuid);
+    dict_write_uint8(dict, MSG_KEY_PROTO, MQ_PROTO_VERSION);
+
+    if (peer_proto == MQ_PROTO_LEGACY && !has_field(&mq->record, MSG_KEY_DATA)) {
+        dict_write_cstring(dict, MSG_KEY_DATA, "");
+    }
+
+    // ACKs that don't fit next to a fragment wait for the next one
+    uint8_t ack_count = peer_proto != MQ_PROTO_LEGACY ? pending_ack_count : 0;
+    if (mq->blob) {
+        ack_count = MIN(ack_count, fragment_ack_count(mq));
+        write_fragment(dict, mq, ack_count);
+    }
+
+    if (ack_count) {
+        uint8_t acks[MAX_PENDING_ACKS * sizeof(uint32_t)];
+        for (int i = 0; i < ack_count; i++) {
+            for (int b = 0; b < 4; b++) {
+                acks[i * 4 + b] = (pending_acks[i] >> (8 * b)) & 0xFF;
+            }
+        }
+        dict_write_data(dict, MSG_KEY_ACKS, acks, ack_count * sizeof(uint32_t));
+        in_flight_ack_count = ack_count;
+    }
 
     AppMessageResult result = app_message_outbox_send();
     APP_LOG(APP_LOG_LEVEL_DEBUG, "%s %d", translate_error(result), result);
     mq->attempts_left -= 1;
 }
 
+static void remember_ack(uint32_t uuid) {
+    for (int i = 0; i < pending_ack_count; i++) {
+        if (pending_acks[i] == uuid) {
+            return;
+        }
+    }
+
+    // No room: the other side will retransmit and we ACK it then
+    if (pending_ack_count < MAX_PENDING_ACKS) {
+        pending_acks[pending_ack_count++] = uuid;
+    }
+}
+
+static void schedule_standalone_ack() {
+    if (!ack_task) {
+        ack_task = sched_add(ACK_DELAY_MS, ACK_DELAY_SLACK_MS, ack_timer_callback, NULL);
+    }
+}
+
+static void schedule_send(uint32_t delay_ms, uint32_t slack_ms) {
+    if (send_task) {
+        sched_reschedule(send_task, delay_ms);
+    } else {
+        send_task = sched_add(delay_ms, slack_ms, send_timer_callback, NULL);
+    }
+}
+
+// Head of the queue is in flight while it is in the outbox, and a blob stays
+// in flight between fragments once the first one is delivered: nothing goes
+// in front of it and it is neither expired nor evicted half way
+static bool in_flight(const MessageQueue* prev, const MessageQueue* mq) {
+    return prev == NULL && (sending || mq->blob_offset > 0);
+}
+
+// Outbox left for fragment data and ACKs after the rest of the message.
+// Never below MQ_FRAG_MIN_DATA, see the check of FRAG_MAX_OVERHEAD.
+static uint16_t fragment_room(const MessageQueue* mq) {
+    uint16_t used = DICT_HEADER_SIZE
+        + DICT_TUPLE_SIZE(1)     // cmd
+        + DICT_TUPLE_SIZE(4)     // uuid
+        + DICT_TUPLE_SIZE(1)     // proto
+        + DICT_TUPLE_SIZE(4)     // fragment id
+        + 3 * DICT_TUPLE_SIZE(2) // seq, offset, total
+        + DICT_TUPLE_SIZE(0);    // fragment data header
+
+    for (int i = 0; i < mq->record.field_count; i++) {
+        used += DICT_TUPLE_SIZE(mq->record.fields[i].type == MQ_FIELD_DECIMAL ? DECIMAL_SIZE : 4);
+    }
+
+    if (peer_proto == MQ_PROTO_LEGACY) {
+        used += DICT_TUPLE_SIZE(1); // empty data string
+    }
+
+    return PROFILE_OUTBOX_SIZE - used;
+}
+
+// ACKs only take the room fragment data doesn't need beyond MQ_FRAG_MIN_DATA
+static uint8_t fragment_ack_count(const MessageQueue* mq) {
+    uint16_t left = mq->blob_length - mq->blob_offset;
+    uint16_t spare = fragment_room(mq) - MIN(left, MQ_FRAG_MIN_DATA);
+
+    if (spare < DICT_TUPLE_SIZE(sizeof(uint32_t))) {
+        return 0;
+    }
+
+    return MIN((spare - DICT_TUPLE_SIZE(0)) / sizeof(uint32_t), MAX_PENDING_ACKS);
+}
+
+static void write_fragment(DictionaryIterator* dict, MessageQueue* mq, uint8_t ack_count) {
+    uint16_t room = fragment_room(mq);
+    if (ack_count) {
+        room -= DICT_TUPLE_SIZE(ack_count * sizeof(uint32_t));
+    }
+
+    uint16_t left = mq->blob_length - mq->blob_offset;
+    mq->blob_frag_length = MIN(left, room);
+
+    dict_write_uint32(dict, MSG_KEY_FRAG_ID, mq->handle);
+    dict_write_uint16(dict, MSG_KEY_FRAG_SEQ, mq->blob_seq);
+    dict_write_uint16(dict, MSG_KEY_FRAG_OFFSET, mq->blob_offset);
+    dict_write_uint16(dict, MSG_KEY_FRAG_TOTAL, mq->blob_length);
+    dict_write_data(dict, MSG_KEY_FRAG_DATA, mq->blob + mq->blob_offset, mq->blob_frag_length);
+}
+
+// Moves to the next fragment after a delivery. Every fragment is a message of
+// its own for the other side: new uuid and a full set of attempts.
+static bool advance_blob(MessageQueue* mq) {
+    if (!mq->blob) {
+        return false;
+    }
+
+    mq->blob_offset += mq->blob_frag_length;
+    if (mq->blob_offset >= mq->blob_length) {
+        return false;
+    }
+
+    mq->blob_seq += 1;
+    mq->uuid = rand();
+    mq->attempts_left = ATTEMPT_COUNT;
+    return true;
+}
+
+static void receive_fragment(DictionaryIterator* iterator, uint8_t cmd) {
+    BlobReceiver* rx = &blob_receiver;
+
+    Tuple* id = dict_find(iterator, MSG_KEY_FRAG_ID);
+    Tuple* seq = dict_find(iterator, MSG_KEY_FRAG_SEQ);
+    Tuple* offset = dict_find(iterator, MSG_KEY_FRAG_OFFSET);
+    Tuple* total = dict_find(iterator, MSG_KEY_FRAG_TOTAL);
+    Tuple* data = dict_find(iterator, MSG_KEY_FRAG_DATA);
+
+    if (!rx->buffer || !id || !seq || !offset || !total) {
+        return;
+    }
+
+    // First fragment starts a new payload and abandons whatever was in progress
+    if (seq->value->uint16 == 0) {
+        if (total->value->uint16 > rx->capacity) {
+            APP_LOG(APP_LOG_LEVEL_WARNING, "FRAG TOO BIG: %u, %u", cmd, total->value->uint16);
+            rx->active = false;
+            return;
+        }
+
+        rx->active = true;
+        rx->id = id->value->uint32;
+        rx->next_seq = 0;
+        rx->received = 0;
+        rx->total = total->value->uint16;
+    }
+
+    // Duplicates are already filtered by uuid, so anything unexpected means a lost fragment
+    if (!rx->active || id->value->uint32 != rx->id || seq->value->uint16 != rx->next_seq
+            || offset->value->uint16 != rx->received || rx->received + data->length > rx->total) {
+        APP_LOG(APP_LOG_LEVEL_WARNING, "FRAG OUT OF ORDER: %u, %u", cmd, seq->value->uint16);
+        rx->active = false;
+        return;
+    }
+
+    memcpy(rx->buffer + rx->received, data->value->data, data->length);
+    rx->received += data->length;
+    rx->next_seq += 1;
+
+    if (rx->received == rx->total) {
+        rx->active = false;
+        if (rx->handler) {
+            rx->handler(cmd, rx->buffer, rx->total, rx->context);
+        }
+    }
+}
+
+static bool has_field(const MqRecord* record, uint8_t key) {
+    for (int i = 0; i < record->field_count; i++) {
+        if (record->fields[i].key == key) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void write_record(DictionaryIterator* dict, const MqRecord* record) {
+    char decimal[11];
+
+    dict_write_uint8(dict, MSG_KEY_CMD, record->cmd);
+
+    for (int i = 0; i < record->field_count; i++) {
+        const MqField* field = &record->fields[i];
+
+        switch (field->type) {
+            case MQ_FIELD_UINT8:
+                dict_write_uint8(dict, field->key, field->value);
+                break;
+
+            case MQ_FIELD_INT32:
+                dict_write_int32(dict, field->key, field->value);
+                break;
+
+            case MQ_FIELD_DECIMAL:
+                snprintf(decimal, sizeof(decimal), "%lu", (unsigned long)(uint32_t)field->value);
+                dict_write_cstring(dict, field->key, decimal);
+                break;
+
+            default:
+                dict_write_uint32(dict, field->key, field->value);
+                break;
+        }
+    }
+}
+
 static char *translate_error(AppMessageResult result) {
     switch (result) {
         case APP_MSG_OK: return "APP_MSG_OK";
@@ -198,5 +753,20 @@ static char *translate_error(AppMessageResult result) {
 }
 
 static void send_timer_callback(void* context) {
+    send_task = NULL;
     send_next_message();
 }
+
+static void ack_timer_callback(void* context) {
+    ack_task = NULL;
+
+    // Something else is going out anyway, ACKs will ride along
+    if (msg_queue || sending || !pending_ack_count) {
+        return;
+    }
+
+    MqRecord ack = {
+        .cmd = MQ_CMD_OUT_ACK
+    };
+    mq_add_record(&ack, MQ_PRIORITY_CONTROL, ACK_TTL_SECS);
+}
@@ -14,17 +14,127 @@ typedef void (*MessageHandler)(DictionaryIterator *iterator);
 enum {
     MSG_KEY_CMD = 10,
     MSG_KEY_DATA = 11,
-    MSG_KEY_UUID = 12
+    MSG_KEY_UUID = 12,
+    MSG_KEY_ACKS = 13, // byte array of little endian uint32 ids of received messages
+
+    // Fragment of a payload too big for one message, fragments go in order
+    MSG_KEY_FRAG_ID = 14,     // uint32, same for all fragments of a payload
+    MSG_KEY_FRAG_SEQ = 15,    // uint16, 0 for the first fragment
+    MSG_KEY_FRAG_OFFSET = 16, // uint16, position of this fragment in the payload
+    MSG_KEY_FRAG_TOTAL = 17,  // uint16, length of the whole payload
+    MSG_KEY_FRAG_DATA = 18,   // bytes
+
+    MSG_KEY_PROTO = 19 // uint8, protocol version of the sender, missing means MQ_PROTO_LEGACY
 };
 
+// Legacy peers get the original format: MSG_KEY_DATA string in every message
+// and one CMD_OUT_ACK per received message with the id as a decimal string.
+// Newer peers get ACKs piggybacked in MSG_KEY_ACKS. Version of the peer is
+// taken from the last message it sent, until then it is assumed to be legacy.
+#define MQ_PROTO_LEGACY 1
+#define MQ_PROTO_VERSION 2
+
+// Standalone ACK: legacy peers get the id in MSG_KEY_DATA, newer ones in MSG_KEY_ACKS
+#define MQ_CMD_OUT_ACK 8
+
+// Fragment data is never cut below this to make room for piggybacked ACKs
+#define MQ_FRAG_MIN_DATA 32
+
+// Lower value is sent first. Messages with the same priority keep their order.
+typedef enum {
+    MQ_PRIORITY_CONTROL = 0, // ACKs and other protocol messages
+    MQ_PRIORITY_NORMAL = 1,
+    MQ_PRIORITY_BULK = 2     // data requests, safe to drop under pressure
+} MqPriority;
+
+// Messages not sent within TTL are dropped unsent
+#define MQ_DEFAULT_TTL_SECS (10 * 60)
+
+// Hard cap for memory used by queued messages
+#define MQ_MAX_BYTES 1024
+
+// Payload is kept as a small typed record and only serialized
+// into the outbox when it is actually sent
+#define MQ_MAX_FIELDS 2
+
+typedef enum {
+    MQ_FIELD_UINT8,
+    MQ_FIELD_INT32,
+    MQ_FIELD_UINT32,
+    MQ_FIELD_DECIMAL // uint32 written as a decimal string
+} MqFieldType;
+
+typedef struct {
+    uint8_t key;
+    uint8_t type;
+    int32_t value;
+} MqField;
+
+typedef struct {
+    uint8_t cmd;
+    uint8_t field_count;
+    MqField fields[MQ_MAX_FIELDS];
+} MqRecord;
+
+typedef struct {
+    uint16_t dropped; // evicted or rejected because of MQ_MAX_BYTES
+    uint16_t expired; // TTL ran out before message was delivered
+    uint16_t failed;  // no attempts left
+} MqStats;
+
+// Identifies a submitted message, 0 means it was not accepted
+typedef uint32_t MqHandle;
+
+typedef enum {
+    MQ_STATUS_DELIVERED,
+    MQ_STATUS_EXPIRED, // TTL ran out
+    MQ_STATUS_FAILED,  // no attempts left
+    MQ_STATUS_DROPPED  // evicted because of MQ_MAX_BYTES
+} MqStatus;
+
+// Called exactly once for every accepted message. Latency is measured from submit.
+// It is fine to submit new messages from here.
+typedef void (*MqCompletion)(MqHandle handle, MqStatus status, uint32_t latency_ms, void* context);
+
+typedef struct {
+    MqPriority priority;
+    uint16_t ttl_secs;
+    MqCompletion completion;
+    void* context;
+} MqOptions;
+
+// Called with the reassembled payload, data points into the receive buffer
+// and is only valid during the call
+typedef void (*MqBlobHandler)(uint8_t cmd, const uint8_t* data, uint16_t length, void* context);
+
+typedef enum {
+    MQ_PRESSURE_NONE,
+    MQ_PRESSURE_HIGH,     // queue is filling up or link is failing while messages wait, defer what can wait
+    MQ_PRESSURE_SATURATED // don't add anything that is not essential
+} MqPressure;
+
 void mq_init(MessageHandler handler);
-bool mq_add(uint8_t cmd, char* data);
-
-__attribute__((format(printf, 3, 4))) __attribute__ ((__gnu_inline__))
-extern inline bool mq_fmt(uint8_t cmd, int max_size, char* format, ...)  {
-    char buf[max_size + 1];
-    snprintf(buf, max_size, format, __builtin_va_arg_pack ());
-    return mq_add(cmd, buf);
-}
+
+// Drops everything queued without calling completions and stops all timers.
+// AppMessage buffers can't be closed, they are reused by the next mq_init.
+void mq_deinit(void);
+size_t mq_buffer_bytes(void);
+
+MqHandle mq_submit(const MqRecord* record, const MqOptions* options);
+MqPressure mq_pressure(void);
+
+// Payload is sent in fragments straight from data, it is not copied,
+// so data must stay valid until the completion is called.
+// Every fragment carries the record, so keep the record small.
+// Once the first fragment is delivered the rest go out before anything
+// else, and TTL and MQ_MAX_BYTES no longer apply to the message.
+MqHandle mq_submit_blob(const MqRecord* record, const uint8_t* data, uint16_t length, const MqOptions* options);
+
+// Incoming fragments are reassembled into buffer, one payload at a time.
+// Payloads bigger than capacity are dropped.
+void mq_set_blob_receiver(uint8_t* buffer, uint16_t capacity, MqBlobHandler handler, void* context);
+
+bool mq_add_record(const MqRecord* record, MqPriority priority, uint16_t ttl_secs);
+void mq_get_stats(MqStats* stats);
 
 #endif /* AK_MESSAGE_QUEUE_H */
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <pebble.h>
+
+// Compile time build profile. wscript defines AK_PROFILE_* per target
+// platform (see PROFILES there).
+//
+// PROFILE_HEAP_BUDGET is heap in use once the face is fully loaded,
+// running animation included: what tests/test-face.c measures against
+// the SDK stub plus ~15%.
+// The host test fails when the face grows past it.
+
+#if defined(AK_PROFILE_LOW_MEM)
+
+// aplite: 1-bit assets (converted by the SDK), single custom font,
+// no full screen animation and small AppMessage buffers. Outbox still
+// takes a fragment of FRAG_MIN_DATA bytes, see message-queue.c.
+#define PROFILE_ANIMATIONS 0
+#define PROFILE_STEPS_FONT 0
+#define PROFILE_INBOX_SIZE 256
+#define PROFILE_OUTBOX_SIZE 192
+#define PROFILE_HEAP_BUDGET 7680
+
+#else
+
+#define PROFILE_ANIMATIONS 1
+#define PROFILE_STEPS_FONT 1
+#define PROFILE_INBOX_SIZE 512
+#define PROFILE_OUTBOX_SIZE 768
+#define PROFILE_HEAP_BUDGET 26368
+
+#endif
+
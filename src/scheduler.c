@@ -0,0 +1,181 @@
+#include <pebble.h>
+#include "scheduler.h"
+#include "utils.h"
+
+struct SchedTask {
+    bool active;
+    uint32_t earliest_ms;
+    uint32_t latest_ms;
+    uint32_t slack_ms;
+    SchedCallback callback;
+    void *context;
+};
+
+static SchedTask s_tasks[SCHED_MAX_TASKS];
+static AppTimer *s_timer = NULL;
+static bool s_minute_ticks = false;
+
+static time_t s_wakeup_hour = 0;
+static uint16_t s_wakeups_this_hour = 0;
+static uint16_t s_wakeups_last_hour = 0;
+
+static void timer_callback(void *context);
+
+// now_ms() wraps around, so only differences are compared
+static bool is_before(uint32_t a, uint32_t b) {
+    return (int32_t)(a - b) < 0;
+}
+
+static uint32_t ms_to_next_tick() {
+    time_t secs;
+    uint16_t ms;
+    time_ms(&secs, &ms);
+    return (60 - secs % 60) * 1000 - ms;
+}
+
+static void count_wakeup() {
+    time_t hour = time(NULL) / (60 * 60);
+
+    if (hour != s_wakeup_hour) {
+        if (s_wakeup_hour) {
+            APP_LOG(APP_LOG_LEVEL_INFO, "Wakeups last hour: %u", s_wakeups_this_hour);
+        }
+
+        s_wakeups_last_hour = s_wakeup_hour + 1 == hour ? s_wakeups_this_hour : 0;
+        s_wakeups_this_hour = 0;
+        s_wakeup_hour = hour;
+    }
+
+    s_wakeups_this_hour += 1;
+}
+
+static void arm() {
+    uint32_t now = now_ms();
+    SchedTask *first = NULL;
+
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        SchedTask *task = &s_tasks[i];
+        if (task->active && (!first || is_before(task->latest_ms, first->latest_ms))) {
+            first = task;
+        }
+    }
+
+    // Nothing to do, or the next minute tick comes in time for everything
+    if (!first || (s_minute_ticks && !is_before(first->latest_ms, now + ms_to_next_tick()))) {
+        if (s_timer) {
+            app_timer_cancel(s_timer);
+            s_timer = NULL;
+        }
+        return;
+    }
+
+    uint32_t delay = is_before(now, first->latest_ms) ? first->latest_ms - now : 0;
+
+    if (s_timer) {
+        app_timer_reschedule(s_timer, delay);
+    } else {
+        s_timer = app_timer_register(delay, timer_callback, NULL);
+    }
+}
+
+// Runs everything whose window has opened. Slot is released before the
+// callback, so callbacks are free to add, cancel and reschedule. Tasks
+// added by callbacks wait for the next pass.
+static void run_due() {
+    uint32_t now = now_ms();
+    uint32_t due = 0;
+
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        if (s_tasks[i].active && !is_before(now, s_tasks[i].earliest_ms)) {
+            due |= 1u << i;
+        }
+    }
+
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        SchedTask *task = &s_tasks[i];
+        if ((due & (1u << i)) && task->active && !is_before(now, task->earliest_ms)) {
+            task->active = false;
+            task->callback(task->context);
+        }
+    }
+
+    arm();
+}
+
+static void timer_callback(void *context) {
+    s_timer = NULL;
+    count_wakeup();
+    run_due();
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+SchedTask* sched_add(uint32_t delay_ms, uint32_t slack_ms, SchedCallback callback, void *context) {
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        SchedTask *task = &s_tasks[i];
+        if (!task->active) {
+            *task = (SchedTask) {
+                .active = true,
+                .slack_ms = slack_ms,
+                .callback = callback,
+                .context = context
+            };
+
+            sched_reschedule(task, delay_ms);
+            return task;
+        }
+    }
+
+    APP_LOG(APP_LOG_LEVEL_ERROR, "No free scheduler slots");
+    return NULL;
+}
+
+void sched_reschedule(SchedTask *task, uint32_t delay_ms) {
+    if (!task || !task->active) {
+        return;
+    }
+
+    task->earliest_ms = now_ms() + delay_ms;
+    task->latest_ms = task->earliest_ms + task->slack_ms;
+    arm();
+}
+
+void sched_cancel(SchedTask *task) {
+    if (!task || !task->active) {
+        return;
+    }
+
+    task->active = false;
+    arm();
+}
+
+void sched_use_minute_ticks(bool enabled) {
+    s_minute_ticks = enabled;
+    arm();
+}
+
+void sched_on_minute_tick(void) {
+    count_wakeup();
+    run_due();
+}
+
+void sched_deinit(void) {
+    for (int i = 0; i < SCHED_MAX_TASKS; i++) {
+        s_tasks[i].active = false;
+    }
+
+    if (s_timer) {
+        app_timer_cancel(s_timer);
+        s_timer = NULL;
+    }
+
+    s_minute_ticks = false;
+}
+
+uint16_t sched_get_wakeups_this_hour(void) {
+    return s_wakeups_this_hour;
+}
+
+uint16_t sched_get_wakeups_last_hour(void) {
+    return s_wakeups_last_hour;
+}
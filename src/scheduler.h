@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pebble.h>
+
+// Single owner of deferred work. Every task has a window: it runs no earlier
+// than delay_ms and no later than delay_ms + slack_ms. Tasks whose windows
+// overlap run together, tasks that can wait for the next minute tick ride on
+// it, and only one app_timer is armed for the earliest hard deadline.
+//
+// Like AppTimer, a task pointer is invalid once the task has run or was cancelled.
+
+#define SCHED_MAX_TASKS 12
+
+typedef struct SchedTask SchedTask;
+typedef void (*SchedCallback)(void *context);
+
+SchedTask* sched_add(uint32_t delay_ms, uint32_t slack_ms, SchedCallback callback, void *context);
+void sched_reschedule(SchedTask *task, uint32_t delay_ms);
+void sched_cancel(SchedTask *task);
+
+// Minute ticks are free wakeups. Call sched_on_minute_tick from the tick
+// handler and tell the scheduler whether ticks are coming at all.
+void sched_use_minute_ticks(bool enabled);
+void sched_on_minute_tick(void);
+
+void sched_deinit(void);
+
+// Wakeups are app_timer fires plus minute ticks
+uint16_t sched_get_wakeups_this_hour(void);
+uint16_t sched_get_wakeups_last_hour(void);
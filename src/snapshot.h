@@ -0,0 +1,40 @@
+#pragma once
+
+// Shared between the face (src/) and the background worker (worker_src/).
+// Must be included after pebble.h / pebble_worker.h.
+
+// Persistent storage keys
+#define PERSIST_KEY_DATA 1
+#define PERSIST_KEY_STEPS 2
+#define PERSIST_KEY_FORECAST 3
+#define PERSIST_KEY_FRAME 4        // header of the last rendered frame
+#define PERSIST_KEY_FRAME_CHUNKS 5 // and on, compressed frame in FRAME_SNAPSHOT_MAX_CHUNKS keys
+#define PERSIST_KEY_WORKER_LAUNCHED 32 // bool, face launched the worker once
+
+// Data from the phone is refreshed this often unless forecast covers more
+#define FETCH_INTERVAL_SECS (30 * 60)
+
+// Messages between the face and the worker (app_worker_send_message)
+enum {
+    WORKER_MSG_STEPS = 1,     // worker -> face: data0 | data1 << 16 = steps today, data2 = 1 if health has them
+    WORKER_MSG_FETCH_DUE = 2, // worker -> face: time to ask the phone for data
+    WORKER_MSG_FETCHED = 3    // face -> worker: fresh data was received and persisted
+};
+
+// Last CMD_IN_GET_DATA_RESPONSE as stored by the face
+typedef struct {
+    time_t fetched_at;
+    time_t next_fetch_at;
+    uint32_t state_version; // as reported by the phone, 0 = unversioned
+    int32_t alarm_mins;
+    int8_t temp;
+    int8_t icon;
+    int8_t hum;
+} DataSnapshot;
+
+// Step count as maintained by the worker
+typedef struct {
+    time_t day_start;
+    int32_t steps;
+    bool available; // false when there is no health service or no access to it
+} StepsSnapshot;
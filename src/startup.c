@@ -0,0 +1,130 @@
+#include <pebble.h>
+#include "startup.h"
+#include "utils.h"
+#include "scheduler.h"
+
+// Gap between deferred stages, lets input and redraws in between
+#define STAGE_GAP_MS 10
+
+// Don't wait forever if first frame somehow never comes
+#define FIRST_FRAME_TIMEOUT_MS 200
+
+static const StartupStage *s_stages = NULL;
+static uint8_t s_stage_count = 0;
+static uint8_t s_next_stage = 0;
+static SchedTask *s_task = NULL;
+
+static uint32_t s_begin_ms = 0;
+static uint16_t s_stage_ms[STARTUP_MAX_STAGES];
+static uint16_t s_first_frame_ms = 0;
+static uint16_t s_total_ms = 0;
+
+static void run_next_stage(void *context);
+
+static void schedule_next_stage(uint32_t delay_ms) {
+    if (s_task) {
+        sched_reschedule(s_task, delay_ms);
+    } else {
+        s_task = sched_add(delay_ms, 0, run_next_stage, NULL);
+    }
+}
+
+static void run_stage(uint8_t i) {
+    uint32_t start = now_ms();
+    s_stages[i].run();
+    s_stage_ms[i] = now_ms() - start;
+}
+
+static void report() {
+    APP_LOG(APP_LOG_LEVEL_INFO, "Startup: first frame=%u ms, total=%u ms", s_first_frame_ms, s_total_ms);
+
+    for (int i = 0; i < s_stage_count; i++) {
+        APP_LOG(APP_LOG_LEVEL_INFO, "Startup stage %s: %u ms", s_stages[i].name, s_stage_ms[i]);
+    }
+}
+
+static void run_next_stage(void *context) {
+    s_task = NULL;
+
+    if (s_next_stage >= s_stage_count) {
+        return;
+    }
+
+    run_stage(s_next_stage++);
+
+    if (s_next_stage < s_stage_count) {
+        schedule_next_stage(STAGE_GAP_MS);
+    } else {
+        s_total_ms = now_ms() - s_begin_ms;
+        report();
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+void startup_begin(void) {
+    s_begin_ms = now_ms();
+    s_first_frame_ms = 0;
+    s_total_ms = 0;
+}
+
+void startup_run(const StartupStage *stages, uint8_t count) {
+    s_stages = stages;
+    s_stage_count = count < STARTUP_MAX_STAGES ? count : STARTUP_MAX_STAGES;
+    s_next_stage = 0;
+    memset(s_stage_ms, 0, sizeof(s_stage_ms));
+
+    if (!s_stage_count) {
+        return;
+    }
+
+    run_stage(s_next_stage++);
+
+    if (s_next_stage < s_stage_count) {
+        schedule_next_stage(FIRST_FRAME_TIMEOUT_MS);
+    } else {
+        s_total_ms = now_ms() - s_begin_ms;
+        report();
+    }
+}
+
+void startup_cancel(void) {
+    if (s_task) {
+        sched_cancel(s_task);
+        s_task = NULL;
+    }
+
+    s_next_stage = s_stage_count;
+}
+
+void startup_mark_first_frame(void) {
+    if (s_first_frame_ms) {
+        return;
+    }
+
+    s_first_frame_ms = now_ms() - s_begin_ms;
+    if (!s_first_frame_ms) {
+        s_first_frame_ms = 1;
+    }
+
+    // Deferred stages start as soon as the first frame is out
+    if (s_next_stage < s_stage_count) {
+        schedule_next_stage(0);
+    }
+}
+
+bool startup_is_done(void) {
+    return s_next_stage >= s_stage_count;
+}
+
+uint16_t startup_get_stage_ms(uint8_t stage) {
+    return stage < STARTUP_MAX_STAGES ? s_stage_ms[stage] : 0;
+}
+
+uint16_t startup_get_first_frame_ms(void) {
+    return s_first_frame_ms;
+}
+
+uint16_t startup_get_total_ms(void) {
+    return s_total_ms;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <pebble.h>
+
+// Startup split into stages. The first stage runs right away and should
+// only put something on the screen. The rest run one by one
+// once the first frame has been drawn. Each stage is timed.
+// Deferred stages are scheduler tasks without slack.
+
+#define STARTUP_MAX_STAGES 6
+
+typedef void (*StartupStageRun)(void);
+
+typedef struct {
+    const char *name;
+    StartupStageRun run;
+} StartupStage;
+
+void startup_begin(void);
+void startup_run(const StartupStage *stages, uint8_t count);
+void startup_cancel(void);
+// Only the first call after startup_begin() counts, later ones return right away
+void startup_mark_first_frame(void);
+bool startup_is_done(void);
+
+// All times are in ms. Stage time is time spent inside the stage,
+// first frame and total are measured from startup_begin().
+uint16_t startup_get_stage_ms(uint8_t stage);
+uint16_t startup_get_first_frame_ms(void);
+uint16_t startup_get_total_ms(void);
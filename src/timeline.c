@@ -0,0 +1,246 @@
+#include <pebble.h>
+#include "timeline.h"
+
+// Only logged when the timeline is done
+typedef struct {
+    uint16_t rendered;
+    uint16_t skipped;
+} TimelineStats;
+
+struct Timeline {
+    Animation *animation;
+    uint32_t duration_ms;
+    bool reverse;
+    uint8_t fps;
+
+    TimelineTrack tracks[TIMELINE_MAX_TRACKS];
+    uint8_t track_count;
+
+    // Precomputed positions: frame_count entries per track
+    int16_t *tables;
+    uint16_t frame_count;
+
+    int16_t last_values[TIMELINE_MAX_TRACKS];
+    int32_t last_frame;
+    TimelineStats stats;
+
+    TimelineRender render;
+    TimelineStopped stopped;
+    void *context;
+};
+
+static void animation_update(Animation *animation, const AnimationProgress progress);
+static void animation_stopped(Animation *animation, bool finished, void *context);
+
+// Curves operate on 0..ANIMATION_NORMALIZED_MAX and never leave that range
+static uint32_t ease_in(uint32_t t) {
+    if (t > ANIMATION_NORMALIZED_MAX) {
+        t = ANIMATION_NORMALIZED_MAX;
+    }
+    return (t * t) / ANIMATION_NORMALIZED_MAX;
+}
+
+static uint32_t apply_curve(AnimationCurve curve, uint32_t t) {
+    const uint32_t max = ANIMATION_NORMALIZED_MAX;
+
+    switch (curve) {
+        case AnimationCurveEaseIn:
+            return ease_in(t);
+
+        case AnimationCurveEaseOut:
+            return max - ease_in(max - t);
+
+        case AnimationCurveEaseInOut:
+            if (t < max / 2) {
+                return ease_in(t * 2) / 2;
+            }
+            return max - ease_in((max - t) * 2) / 2;
+
+        default:
+            return t;
+    }
+}
+
+static void free_tables(Timeline *timeline) {
+    if (timeline->tables) {
+        free(timeline->tables);
+        timeline->tables = NULL;
+    }
+}
+
+static bool build_tables(Timeline *timeline) {
+    uint16_t frames = (timeline->duration_ms * timeline->fps) / 1000 + 1;
+    if (frames < 2) {
+        frames = 2;
+    }
+
+    free_tables(timeline);
+    timeline->tables = malloc(sizeof(int16_t) * frames * timeline->track_count);
+    if (!timeline->tables) {
+        return false;
+    }
+
+    timeline->frame_count = frames;
+
+    for (int i = 0; i < timeline->track_count; i++) {
+        const TimelineTrack *track = &timeline->tracks[i];
+        int16_t *table = timeline->tables + i * frames;
+        int32_t span = track->to - track->from;
+
+        for (int f = 0; f < frames; f++) {
+            uint32_t t = ((uint32_t)f * ANIMATION_NORMALIZED_MAX) / (frames - 1);
+            uint32_t c = apply_curve(track->curve, t);
+            table[f] = track->from + ((int64_t)span * c) / ANIMATION_NORMALIZED_MAX;
+        }
+    }
+
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+Timeline* timeline_create(uint32_t duration_ms, uint8_t fps) {
+    Timeline *timeline = malloc(sizeof(Timeline));
+    if (!timeline) {
+        return NULL;
+    }
+
+    memset(timeline, 0, sizeof(Timeline));
+    timeline->duration_ms = duration_ms;
+    timeline->fps = fps ? fps : TIMELINE_DEFAULT_FPS;
+
+    return timeline;
+}
+
+bool timeline_add_track(Timeline *timeline, const TimelineTrack *track) {
+    if (timeline->animation || timeline->track_count >= TIMELINE_MAX_TRACKS) {
+        return false;
+    }
+
+    timeline->tracks[timeline->track_count++] = *track;
+    return true;
+}
+
+void timeline_set_reverse(Timeline *timeline, bool reverse) {
+    timeline->reverse = reverse;
+}
+
+void timeline_set_handlers(Timeline *timeline, TimelineRender render, TimelineStopped stopped, void *context) {
+    timeline->render = render;
+    timeline->stopped = stopped;
+    timeline->context = context;
+}
+
+bool timeline_start(Timeline *timeline) {
+    if (timeline->animation || !build_tables(timeline)) {
+        return false;
+    }
+
+    timeline->last_frame = -1;
+    timeline->stats = (TimelineStats) {0};
+
+    // Initial position is applied right away, so the first
+    // frame is drawn correctly before the animation delivers one
+    int16_t initial_frame = timeline->reverse ? timeline->frame_count - 1 : 0;
+    for (int i = 0; i < timeline->track_count; i++) {
+        const TimelineTrack *track = &timeline->tracks[i];
+        timeline->last_values[i] = timeline->tables[i * timeline->frame_count + initial_frame];
+        track->apply(timeline->last_values[i], track->context);
+    }
+
+    // Curves are already in the tables, pebble should deliver linear progress
+    Animation *animation = animation_create();
+    animation_set_duration(animation, timeline->duration_ms);
+    animation_set_curve(animation, AnimationCurveLinear);
+    animation_set_reverse(animation, timeline->reverse);
+
+    static const AnimationImplementation impl = {
+        .update = animation_update
+    };
+
+    animation_set_implementation(animation, &impl);
+    animation_set_handlers(animation, (AnimationHandlers) {
+        .stopped = animation_stopped
+    }, timeline);
+
+    timeline->animation = animation;
+    animation_schedule(animation);
+
+    return true;
+}
+
+void timeline_stop(Timeline *timeline) {
+    if (timeline->animation) {
+        animation_unschedule(timeline->animation);
+    }
+}
+
+void timeline_destroy(Timeline *timeline) {
+    if (!timeline) {
+        return;
+    }
+
+    timeline->stopped = NULL;
+    timeline_stop(timeline);
+
+    if (timeline->animation) {
+        animation_destroy(timeline->animation);
+        timeline->animation = NULL;
+    }
+
+    free_tables(timeline);
+    free(timeline);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+static void animation_update(Animation *animation, const AnimationProgress progress) {
+    Timeline *timeline = animation_get_context(animation);
+
+    // Frame rate cap: updates falling into the same frame slot are dropped
+    int32_t frame = ((uint32_t)progress * (timeline->frame_count - 1)) / ANIMATION_NORMALIZED_MAX;
+    if (frame == timeline->last_frame) {
+        timeline->stats.skipped++;
+        return;
+    }
+
+    timeline->last_frame = frame;
+
+    bool changed = false;
+    for (int i = 0; i < timeline->track_count; i++) {
+        int16_t value = timeline->tables[i * timeline->frame_count + frame];
+        if (value != timeline->last_values[i]) {
+            const TimelineTrack *track = &timeline->tracks[i];
+            timeline->last_values[i] = value;
+            track->apply(value, track->context);
+            changed = true;
+        }
+    }
+
+    if (!changed) {
+        timeline->stats.skipped++;
+        return;
+    }
+
+    timeline->stats.rendered++;
+
+    if (timeline->render) {
+        timeline->render(timeline->context);
+    }
+}
+
+static void animation_stopped(Animation *animation, bool finished, void *context) {
+    Timeline *timeline = context;
+
+    APP_LOG(APP_LOG_LEVEL_DEBUG, "Timeline done: rendered=%u, skipped=%u, frames=%u",
+            timeline->stats.rendered, timeline->stats.skipped, timeline->frame_count);
+
+    animation_destroy(animation);
+    timeline->animation = NULL;
+    free_tables(timeline);
+
+    // This must be the last thing, the handler is allowed to destroy the timeline
+    if (timeline->stopped) {
+        timeline->stopped(timeline, finished, timeline->context);
+    }
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <pebble.h>
+
+// Small keyframe engine on top of a single pebble Animation.
+// Every track is a declarative "from -> to along a curve" description.
+// Position tables are computed once when timeline is started, so
+// per-frame work is a table lookup and a comparison with the last
+// applied value. Frames that would not change anything are skipped.
+
+#define TIMELINE_MAX_TRACKS 4
+#define TIMELINE_DEFAULT_FPS 25
+
+typedef void (*TrackApply)(int16_t value, void *context);
+
+typedef struct {
+    AnimationCurve curve;
+    int16_t from;
+    int16_t to;
+    TrackApply apply;
+    void *context;
+} TimelineTrack;
+
+typedef struct Timeline Timeline;
+
+typedef void (*TimelineRender)(void *context);
+typedef void (*TimelineStopped)(Timeline *timeline, bool finished, void *context);
+
+Timeline* timeline_create(uint32_t duration_ms, uint8_t fps);
+bool timeline_add_track(Timeline *timeline, const TimelineTrack *track);
+void timeline_set_reverse(Timeline *timeline, bool reverse);
+void timeline_set_handlers(Timeline *timeline, TimelineRender render, TimelineStopped stopped, void *context);
+bool timeline_start(Timeline *timeline);
+void timeline_stop(Timeline *timeline);
+void timeline_destroy(Timeline *timeline);
@@ -1,18 +1,9 @@
 #include "utils.h"
 #include <pebble.h>
 
-char* strdup(const char *s) {
-    char *p;
-
-    if (s == NULL) {
-        return NULL;
-    }
-
-    if ((p = (char *)malloc(strlen(s)+1)) == NULL) {
-        return NULL;
-    }
-
-    strcpy(p, s);
-
-    return p;
+uint32_t now_ms(void) {
+    time_t secs;
+    uint16_t ms;
+    time_ms(&secs, &ms);
+    return (uint32_t)secs * 1000 + ms;
 }
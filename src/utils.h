@@ -1,3 +1,6 @@
 #pragma once
 
-char* strdup(const char *s);
+#include <pebble.h>
+
+// Wall clock in ms, wraps around. Only good for measuring intervals.
+uint32_t now_ms(void);
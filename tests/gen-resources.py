@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+
+# Generates resource ids and the resource table of the SDK stub for one
+# platform from appinfo.json, the way the SDK build does for the watch.
+# Fonts are rendered into 1-bit glyphs at the size in their name and images
+# are reduced to the 64 colors of the watch, so the stub draws real frames.
+#
+# Usage: gen-resources.py PLATFORM OUTDIR
+
+import json
+import os
+import re
+import sys
+
+from PIL import Image, ImageFont
+
+TOP = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..')
+TYPES = {'raw': 'STUB_RES_RAW', 'png': 'STUB_RES_PNG', 'font': 'STUB_RES_FONT'}
+
+
+# Only single character classes like [a-z0-9 >] are used by the face
+def font_characters(regex):
+    chars = []
+    for first, last in re.findall(r'(.)(?:-(.))?', regex.strip('[]')):
+        chars += [chr(c) for c in range(ord(first), ord(last or first) + 1)]
+    return chars
+
+
+def write_glyphs(f, m):
+    font = ImageFont.truetype(os.path.join(TOP, 'resources', m['file']), int(m['name'].rsplit('_', 1)[1]))
+    glyphs, bits = [], []
+    for c in font_characters(m.get('characterRegex', '[ -~]')):
+        mask = font.getmask(c, mode='1')
+        x, y = font.getbbox(c)[:2]
+        w, h = mask.size
+        glyphs.append((ord(c), int(font.getlength(c)), x, y, w, h, len(bits)))
+        for row in range(h):
+            for byte in range(0, w, 8):
+                bits.append(sum(0x80 >> b for b in range(min(8, w - byte)) if mask.getpixel((byte + b, row))))
+    f.write('static const uint8_t s_glyph_bits_{}[] = {{{}}};\n'.format(m['name'], ', '.join(map(str, bits or [0]))))
+    f.write('static const StubGlyph s_glyphs_{}[] = {{\n'.format(m['name']))
+    for g in glyphs:
+        f.write('    {{{}, {}, {}, {}, {}, {}, {}}},\n'.format(*g))
+    f.write('};\n\n')
+    return sum(font.getmetrics())
+
+
+# One GColor8 per pixel, read by the stub when the bitmap is created
+def write_pixels(image, m):
+    path = os.path.abspath(os.path.join(outdir, m['name'] + '.argb8'))
+    with open(path, 'wb') as f:
+        f.write(bytes((a >> 6) << 6 | (r >> 6) << 4 | (g >> 6) << 2 | b >> 6 for r, g, b, a in image.getdata()))
+    return path
+
+platform, outdir = sys.argv[1:3]
+
+with open(os.path.join(TOP, 'appinfo.json')) as f:
+    media = json.load(f)['resources']['media']
+
+media = [m for m in media if platform in m.get('targetPlatforms', [platform])]
+
+os.makedirs(outdir, exist_ok=True)
+
+with open(os.path.join(outdir, 'resource_ids.auto.h'), 'w') as f:
+    f.write('#pragma once\n\n')
+    for n, m in enumerate(media, 1):
+        f.write('#define RESOURCE_ID_{} {}\n'.format(m['name'], n))
+
+with open(os.path.join(outdir, 'stub-resources.auto.h'), 'w') as f:
+    entries = []
+    for m in media:
+        width, height, colors, pixels, glyphs = 0, 0, 0, 'NULL', 'NULL, NULL, 0'
+        if m['type'] == 'png':
+            image = Image.open(os.path.join(TOP, 'resources', m['file'])).convert('RGBA')
+            width, height = image.size
+            # Counted after reduction to the 64 colors of the watch
+            colors = len(set((r >> 6, g >> 6, b >> 6, a >> 6) for r, g, b, a in image.getdata()))
+            pixels = '"{}"'.format(write_pixels(image, m))
+        elif m['type'] == 'font':
+            # Height of a font is its line height
+            height = write_glyphs(f, m)
+            glyphs = 's_glyphs_{0}, s_glyph_bits_{0}, ARRAY_LENGTH(s_glyphs_{0})'.format(m['name'])
+        entries.append('    {{"{}", {}, {}, {}, {}, {}, {}}},\n'.format(
+            m['file'], TYPES[m['type']], width, height, colors, pixels, glyphs))
+    f.write('static const StubResource s_resources[] = {\n')
+    f.writelines(entries)
+    f.write('};\n')
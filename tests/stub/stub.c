@@ -0,0 +1,2047 @@
+#include <pebble.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include "stub.h"
+
+// The stub itself allocates with the real allocator
+#undef malloc
+#undef calloc
+#undef realloc
+#undef free
+#undef time
+#undef rand
+
+// What SDK objects take on the watch heap (firmware 3.x, rounded up)
+#define HEAP_BLOCK_HEADER 8
+#define WATCH_SIZE_WINDOW 104
+#define WATCH_SIZE_LAYER 44
+#define WATCH_SIZE_TEXT_LAYER 84
+#define WATCH_SIZE_BITMAP_LAYER 56
+#define WATCH_SIZE_GBITMAP 24
+#define WATCH_SIZE_FONT 56
+#define WATCH_SIZE_ANIMATION 72
+#define WATCH_SIZE_APP_TIMER 32
+
+// Memory an app gets for code, data and heap together
+#if defined(PBL_PLATFORM_APLITE)
+#define WATCH_APP_MEMORY (24 * 1024)
+#else
+#define WATCH_APP_MEMORY (64 * 1024)
+#endif
+
+#define FRAME_INTERVAL_MS 33
+#define HEAP_MAGIC 0x48454150u
+
+typedef enum {
+    STUB_RES_RAW,
+    STUB_RES_PNG,
+    STUB_RES_FONT
+} StubResourceType;
+
+// Rows of a glyph are (w + 7) / 8 bytes, leftmost pixel in the top bit
+typedef struct {
+    uint16_t codepoint;
+    uint8_t advance;
+    int8_t x; // from the pen position
+    int8_t y; // from the top of the line
+    uint8_t w;
+    uint8_t h;
+    uint16_t offset; // into the glyph bits
+} StubGlyph;
+
+typedef struct {
+    const char *file;
+    StubResourceType type;
+    uint16_t width;
+    uint16_t height; // line height of a font
+    uint16_t colors;
+    const char *pixels; // file with a GColor8 for every pixel of an image
+    const StubGlyph *glyphs;
+    const uint8_t *glyph_bits;
+    uint16_t glyph_count;
+} StubResource;
+
+#include "stub-resources.auto.h"
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Heap
+
+typedef union {
+    struct {
+        uint32_t magic;
+        size_t charge;
+    };
+    max_align_t align;
+} BlockHeader;
+
+static size_t s_heap_used = 0;
+static size_t s_heap_peak = 0;
+static size_t s_heap_blocks = 0;
+
+static void *tracked_alloc(size_t size, size_t charge) {
+    charge += HEAP_BLOCK_HEADER;
+    if (s_heap_used + charge > WATCH_APP_MEMORY) {
+        return NULL;
+    }
+
+    BlockHeader *header = calloc(1, sizeof(BlockHeader) + size);
+    if (!header) {
+        return NULL;
+    }
+
+    header->magic = HEAP_MAGIC;
+    header->charge = charge;
+
+    s_heap_used += charge;
+    s_heap_blocks += 1;
+    if (s_heap_used > s_heap_peak) {
+        s_heap_peak = s_heap_used;
+    }
+
+    return header + 1;
+}
+
+static void tracked_free(void *ptr) {
+    if (!ptr) {
+        return;
+    }
+
+    BlockHeader *header = (BlockHeader *)ptr - 1;
+    if (header->magic != HEAP_MAGIC) {
+        fprintf(stderr, "stub: free of a block that was not allocated here\n");
+        abort();
+    }
+
+    header->magic = 0;
+    s_heap_used -= header->charge;
+    s_heap_blocks -= 1;
+    free(header);
+}
+
+void *stub_malloc(size_t size) {
+    return tracked_alloc(size, size);
+}
+
+void *stub_calloc(size_t count, size_t size) {
+    return tracked_alloc(count * size, count * size);
+}
+
+void *stub_realloc(void *ptr, size_t size) {
+    if (!ptr) {
+        return stub_malloc(size);
+    }
+
+    BlockHeader *header = (BlockHeader *)ptr - 1;
+    size_t old_size = header->charge - HEAP_BLOCK_HEADER;
+
+    void *moved = stub_malloc(size);
+    if (moved) {
+        memcpy(moved, ptr, old_size < size ? old_size : size);
+        tracked_free(ptr);
+    }
+    return moved;
+}
+
+void stub_free(void *ptr) {
+    tracked_free(ptr);
+}
+
+size_t heap_bytes_used(void) {
+    return s_heap_used;
+}
+
+size_t heap_bytes_free(void) {
+    return WATCH_APP_MEMORY - s_heap_used;
+}
+
+size_t stub_heap_peak(void) {
+    return s_heap_peak;
+}
+
+void stub_heap_reset_peak(void) {
+    s_heap_peak = s_heap_used;
+}
+
+size_t stub_heap_blocks(void) {
+    return s_heap_blocks;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Logging, time and randomness
+
+static uint8_t s_log_level = 0;
+static uint64_t s_now_ms = 0;
+static int s_rand_step = 0;
+static int s_rand_value = 0;
+
+__attribute__((constructor))
+static void stub_setup(void) {
+    // Local time is UTC, so time_start_of_today() and localtime() agree
+    setenv("TZ", "UTC", 1);
+    tzset();
+    stub_set_time(1476086400); // Mon, 10 Oct 2016 08:00:00
+}
+
+void stub_set_log_level(uint8_t level) {
+    s_log_level = level;
+}
+
+void app_log(uint8_t level, const char *src_filename, int src_line_number, const char *fmt, ...) {
+    if (level >= s_log_level) {
+        return;
+    }
+
+    va_list args;
+    va_start(args, fmt);
+    printf("[%u] %s:%d: ", level, src_filename, src_line_number);
+    vprintf(fmt, args);
+    printf("\n");
+    va_end(args);
+}
+
+time_t stub_time(time_t *tloc) {
+    time_t now = s_now_ms / 1000;
+    if (tloc) {
+        *tloc = now;
+    }
+    return now;
+}
+
+uint16_t time_ms(time_t *tloc, uint16_t *out_ms) {
+    uint16_t ms = s_now_ms % 1000;
+    stub_time(tloc);
+    if (out_ms) {
+        *out_ms = ms;
+    }
+    return ms;
+}
+
+time_t time_start_of_today(void) {
+    time_t now = stub_time(NULL);
+    return now - now % (24 * 60 * 60);
+}
+
+uint64_t stub_now_ms(void) {
+    return s_now_ms;
+}
+
+void stub_set_time(time_t secs) {
+    s_now_ms = (uint64_t)secs * 1000;
+}
+
+int stub_rand(void) {
+    if (s_rand_step) {
+        s_rand_value += s_rand_step;
+        return s_rand_value;
+    }
+    return rand();
+}
+
+void stub_set_rand_step(int step) {
+    s_rand_step = step;
+    s_rand_value = 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Graphics
+
+struct GBitmap {
+    uint8_t *data;
+    uint16_t row_size_bytes;
+    GRect bounds;
+    GBitmapFormat format;
+    GColor *palette;
+    bool owns_data;
+};
+
+struct GContext {
+    GBitmap *frame_buffer;
+    bool captured;
+    GPoint offset;
+    GRect clip;
+    GColor fill_color;
+    GColor stroke_color;
+    GColor text_color;
+    GCompOp compositing_mode;
+};
+
+#if defined(PBL_PLATFORM_APLITE)
+#define FRAME_BUFFER_FORMAT GBitmapFormat1Bit
+#define FRAME_BUFFER_ROW_SIZE 20
+#else
+#define FRAME_BUFFER_FORMAT GBitmapFormat8Bit
+#define FRAME_BUFFER_ROW_SIZE STUB_SCREEN_WIDTH
+#endif
+
+static uint8_t s_frame_data[FRAME_BUFFER_ROW_SIZE * STUB_SCREEN_HEIGHT];
+static GBitmap s_frame_buffer = {
+    .data = s_frame_data,
+    .row_size_bytes = FRAME_BUFFER_ROW_SIZE,
+    .bounds = {{0, 0}, {STUB_SCREEN_WIDTH, STUB_SCREEN_HEIGHT}},
+    .format = FRAME_BUFFER_FORMAT
+};
+static GContext s_context = {
+    .frame_buffer = &s_frame_buffer
+};
+
+void grect_clip(GRect * const rect_to_clip, const GRect * const rect_clipper) {
+    int16_t x0 = MAX(rect_to_clip->origin.x, rect_clipper->origin.x);
+    int16_t y0 = MAX(rect_to_clip->origin.y, rect_clipper->origin.y);
+    int16_t x1 = MIN(rect_to_clip->origin.x + rect_to_clip->size.w, rect_clipper->origin.x + rect_clipper->size.w);
+    int16_t y1 = MIN(rect_to_clip->origin.y + rect_to_clip->size.h, rect_clipper->origin.y + rect_clipper->size.h);
+
+    *rect_to_clip = GRect(x0, y0, MAX(x1 - x0, 0), MAX(y1 - y0, 0));
+}
+
+bool grect_equal(const GRect * const rect_a, const GRect * const rect_b) {
+    return memcmp(rect_a, rect_b, sizeof(GRect)) == 0;
+}
+
+bool gcolor_equal(GColor8 x, GColor8 y) {
+    return x.argb == y.argb;
+}
+
+static uint8_t format_bits(GBitmapFormat format) {
+    switch (format) {
+        case GBitmapFormat1Bit:
+        case GBitmapFormat1BitPalette:
+            return 1;
+        case GBitmapFormat2BitPalette:
+            return 2;
+        case GBitmapFormat4BitPalette:
+            return 4;
+        default:
+            return 8;
+    }
+}
+
+static GBitmap *create_bitmap(GSize size, GBitmapFormat format, uint16_t palette_size) {
+    uint8_t bits = format_bits(format);
+    uint16_t row_size = format == GBitmapFormat1Bit ? (size.w + 31) / 32 * 4 : (size.w * bits + 7) / 8;
+    size_t data_size = (size_t)row_size * size.h;
+
+    GBitmap *bitmap = tracked_alloc(sizeof(GBitmap), WATCH_SIZE_GBITMAP + data_size + palette_size);
+    if (!bitmap) {
+        return NULL;
+    }
+
+    bitmap->data = calloc(1, data_size ? data_size : 1);
+    bitmap->palette = palette_size ? calloc(palette_size, sizeof(GColor)) : NULL;
+    bitmap->row_size_bytes = row_size;
+    bitmap->bounds = GRect(0, 0, size.w, size.h);
+    bitmap->format = format;
+    bitmap->owns_data = true;
+    return bitmap;
+}
+
+GBitmap *gbitmap_create_blank(GSize size, GBitmapFormat format) {
+    uint16_t palette_size = format == GBitmapFormat1Bit || format == GBitmapFormat8Bit ? 0 : 1 << format_bits(format);
+    return create_bitmap(size, format, palette_size);
+}
+
+// Palettized formats keep the leftmost pixel in the top bits, 1-bit frames
+// and images in the lowest bit
+static void set_bitmap_index(GBitmap *bitmap, int16_t x, int16_t y, uint8_t index) {
+    uint8_t bits = format_bits(bitmap->format);
+    uint8_t *byte = bitmap->data + y * bitmap->row_size_bytes + x * bits / 8;
+    uint8_t shift = bitmap->format == GBitmapFormat1Bit ? x & 7 : 8 - bits - x * bits % 8;
+    uint8_t mask = ((1 << bits) - 1) << shift;
+
+    *byte = (*byte & ~mask) | (index << shift);
+}
+
+static uint8_t get_bitmap_index(const GBitmap *bitmap, int16_t x, int16_t y) {
+    uint8_t bits = format_bits(bitmap->format);
+    uint8_t byte = bitmap->data[y * bitmap->row_size_bytes + x * bits / 8];
+    uint8_t shift = bitmap->format == GBitmapFormat1Bit ? x & 7 : 8 - bits - x * bits % 8;
+
+    return (byte >> shift) & ((1 << bits) - 1);
+}
+
+static GColor get_bitmap_pixel(const GBitmap *bitmap, int16_t x, int16_t y) {
+    uint8_t index = get_bitmap_index(bitmap, x, y);
+
+    switch (bitmap->format) {
+        case GBitmapFormat1Bit:
+            return index ? GColorWhite : GColorBlack;
+        case GBitmapFormat8Bit:
+            return (GColor) { .argb = index };
+        default:
+            return bitmap->palette[index];
+    }
+}
+
+// Pixels as the SDK build converts them, palette in order of appearance
+static void load_bitmap_pixels(GBitmap *bitmap, const StubResource *res) {
+    FILE *f = fopen(res->pixels, "rb");
+    uint16_t palette_used = 0;
+
+    if (!f) {
+        return;
+    }
+
+    for (int16_t y = 0; y < res->height; y++) {
+        for (int16_t x = 0; x < res->width; x++) {
+            GColor color = { .argb = fgetc(f) };
+            uint8_t index = color.argb;
+
+            if (bitmap->format == GBitmapFormat1Bit) {
+                index = color.a == 3 && color.r + color.g + color.b > 4;
+            } else if (bitmap->palette) {
+                for (index = 0; index < palette_used && bitmap->palette[index].argb != color.argb; index++) {
+                }
+                if (index == palette_used) {
+                    bitmap->palette[palette_used++] = color;
+                }
+            }
+
+            set_bitmap_index(bitmap, x, y, index);
+        }
+    }
+
+    fclose(f);
+}
+
+GBitmap *gbitmap_create_with_resource(uint32_t resource_id) {
+    const StubResource *res = resource_get_handle(resource_id);
+    if (!res || res->type != STUB_RES_PNG) {
+        return NULL;
+    }
+
+    GSize size = GSize(res->width, res->height);
+    GBitmap *bitmap;
+
+#if defined(PBL_PLATFORM_APLITE)
+    // Converted to 1-bit when the app is built
+    bitmap = create_bitmap(size, GBitmapFormat1Bit, 0);
+#else
+    // Decoded into the smallest palettized format that holds all colors
+    if (res->colors <= 2) {
+        bitmap = create_bitmap(size, GBitmapFormat1BitPalette, 2);
+    } else if (res->colors <= 4) {
+        bitmap = create_bitmap(size, GBitmapFormat2BitPalette, 4);
+    } else if (res->colors <= 16) {
+        bitmap = create_bitmap(size, GBitmapFormat4BitPalette, 16);
+    } else {
+        bitmap = create_bitmap(size, GBitmapFormat8Bit, 0);
+    }
+#endif
+
+    if (bitmap) {
+        load_bitmap_pixels(bitmap, res);
+    }
+    return bitmap;
+}
+
+GBitmap *gbitmap_create_as_sub_bitmap(const GBitmap *base_bitmap, GRect sub_rect) {
+    GBitmap *bitmap = tracked_alloc(sizeof(GBitmap), WATCH_SIZE_GBITMAP);
+    if (!bitmap) {
+        return NULL;
+    }
+
+    *bitmap = *base_bitmap;
+    bitmap->owns_data = false;
+    grect_clip(&sub_rect, &base_bitmap->bounds);
+    bitmap->bounds = sub_rect;
+    return bitmap;
+}
+
+void gbitmap_destroy(GBitmap *bitmap) {
+    if (!bitmap) {
+        return;
+    }
+
+    if (bitmap->owns_data) {
+        free(bitmap->data);
+        free(bitmap->palette);
+    }
+    tracked_free(bitmap);
+}
+
+uint8_t *gbitmap_get_data(const GBitmap *bitmap) {
+    return bitmap->data;
+}
+
+uint16_t gbitmap_get_bytes_per_row(const GBitmap *bitmap) {
+    return bitmap->row_size_bytes;
+}
+
+GBitmapFormat gbitmap_get_format(const GBitmap *bitmap) {
+    return bitmap->format;
+}
+
+GRect gbitmap_get_bounds(const GBitmap *bitmap) {
+    return bitmap->bounds;
+}
+
+void gbitmap_set_bounds(GBitmap *bitmap, GRect bounds) {
+    bitmap->bounds = bounds;
+}
+
+GColor *gbitmap_get_palette(const GBitmap *bitmap) {
+    return bitmap->palette;
+}
+
+GBitmap *graphics_capture_frame_buffer(GContext *ctx) {
+    if (ctx->captured) {
+        return NULL;
+    }
+
+    ctx->captured = true;
+    return ctx->frame_buffer;
+}
+
+bool graphics_release_frame_buffer(GContext *ctx, GBitmap *buffer) {
+    if (!ctx->captured || buffer != ctx->frame_buffer) {
+        return false;
+    }
+
+    ctx->captured = false;
+    return true;
+}
+
+void graphics_context_set_stroke_color(GContext *ctx, GColor color) {
+    ctx->stroke_color = color;
+}
+
+void graphics_context_set_fill_color(GContext *ctx, GColor color) {
+    ctx->fill_color = color;
+}
+
+void graphics_context_set_text_color(GContext *ctx, GColor color) {
+    ctx->text_color = color;
+}
+
+void graphics_context_set_stroke_width(GContext *ctx, uint8_t stroke_width) {
+}
+
+void graphics_context_set_compositing_mode(GContext *ctx, GCompOp mode) {
+    ctx->compositing_mode = mode;
+}
+
+// Screen coordinates, clipped to the layer being drawn
+static void put_pixel(GContext *ctx, int16_t x, int16_t y, GColor color) {
+    GRect *clip = &ctx->clip;
+    if (ctx->captured || color.a == 0 || x < clip->origin.x || y < clip->origin.y
+            || x >= clip->origin.x + clip->size.w || y >= clip->origin.y + clip->size.h) {
+        return;
+    }
+
+    GBitmap *fb = ctx->frame_buffer;
+    uint8_t *row = fb->data + y * fb->row_size_bytes;
+
+    if (fb->format == GBitmapFormat1Bit) {
+        bool white = color.r + color.g + color.b > 4;
+        if (white) {
+            row[x >> 3] |= 1 << (x & 7);
+        } else {
+            row[x >> 3] &= ~(1 << (x & 7));
+        }
+    } else {
+        row[x] = color.argb;
+    }
+}
+
+void graphics_draw_pixel(GContext *ctx, GPoint point) {
+    put_pixel(ctx, ctx->offset.x + point.x, ctx->offset.y + point.y, ctx->stroke_color);
+}
+
+void graphics_draw_line(GContext *ctx, GPoint p0, GPoint p1) {
+    int dx = abs(p1.x - p0.x);
+    int dy = -abs(p1.y - p0.y);
+    int sx = p0.x < p1.x ? 1 : -1;
+    int sy = p0.y < p1.y ? 1 : -1;
+    int err = dx + dy;
+
+    for (;;) {
+        graphics_draw_pixel(ctx, p0);
+        if (p0.x == p1.x && p0.y == p1.y) {
+            break;
+        }
+
+        int e2 = 2 * err;
+        if (e2 >= dy) {
+            err += dy;
+            p0.x += sx;
+        }
+        if (e2 <= dx) {
+            err += dx;
+            p0.y += sy;
+        }
+    }
+}
+
+void graphics_fill_rect(GContext *ctx, GRect rect, uint16_t corner_radius, GCornerMask corner_mask) {
+    for (int16_t y = rect.origin.y; y < rect.origin.y + rect.size.h; y++) {
+        for (int16_t x = rect.origin.x; x < rect.origin.x + rect.size.w; x++) {
+            put_pixel(ctx, ctx->offset.x + x, ctx->offset.y + y, ctx->fill_color);
+        }
+    }
+}
+
+// Not tiled, GCompOpSet leaves out transparent pixels and black ones of 1-bit images
+void graphics_draw_bitmap_in_rect(GContext *ctx, const GBitmap *bitmap, GRect rect) {
+    GRect src = bitmap->bounds;
+
+    for (int16_t y = 0; y < MIN(rect.size.h, src.size.h); y++) {
+        for (int16_t x = 0; x < MIN(rect.size.w, src.size.w); x++) {
+            GColor color = get_bitmap_pixel(bitmap, src.origin.x + x, src.origin.y + y);
+            if (ctx->compositing_mode == GCompOpSet && bitmap->format == GBitmapFormat1Bit && !color.r) {
+                continue;
+            }
+            if (ctx->compositing_mode != GCompOpSet) {
+                color.a = 3;
+            }
+            put_pixel(ctx, ctx->offset.x + rect.origin.x + x, ctx->offset.y + rect.origin.y + y, color);
+        }
+    }
+}
+
+GBitmap *stub_frame_buffer(void) {
+    return &s_frame_buffer;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Resources and fonts
+
+struct StubFont {
+    const StubResource *resource;
+};
+
+ResHandle resource_get_handle(uint32_t resource_id) {
+    if (resource_id < 1 || resource_id > ARRAY_LENGTH(s_resources)) {
+        return NULL;
+    }
+    return &s_resources[resource_id - 1];
+}
+
+static FILE *open_resource(ResHandle h) {
+    const StubResource *res = h;
+    char path[512];
+
+    if (!res) {
+        return NULL;
+    }
+
+    snprintf(path, sizeof(path), "%s/%s", STUB_RESOURCES_DIR, res->file);
+    return fopen(path, "rb");
+}
+
+size_t resource_size(ResHandle h) {
+    FILE *f = open_resource(h);
+    if (!f) {
+        return 0;
+    }
+
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fclose(f);
+    return size;
+}
+
+size_t resource_load_byte_range(ResHandle h, uint32_t start_offset, uint8_t *buffer, size_t num_bytes) {
+    FILE *f = open_resource(h);
+    if (!f) {
+        return 0;
+    }
+
+    fseek(f, start_offset, SEEK_SET);
+    size_t read = fread(buffer, 1, num_bytes, f);
+    fclose(f);
+    return read;
+}
+
+size_t resource_load(ResHandle h, uint8_t *buffer, size_t max_length) {
+    return resource_load_byte_range(h, 0, buffer, max_length);
+}
+
+GFont fonts_load_custom_font(ResHandle handle) {
+    const StubResource *res = handle;
+    if (!res || res->type != STUB_RES_FONT) {
+        return NULL;
+    }
+
+    GFont font = tracked_alloc(sizeof(struct StubFont), WATCH_SIZE_FONT);
+    if (font) {
+        font->resource = res;
+    }
+    return font;
+}
+
+void fonts_unload_custom_font(GFont font) {
+    tracked_free(font);
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Layers and windows
+
+struct Layer {
+    GRect frame;
+    GRect bounds;
+    bool hidden;
+    LayerUpdateProc update_proc;
+    Layer *parent;
+    Layer *first_child;
+    Layer *next_sibling;
+    void *data;
+};
+
+struct TextLayer {
+    Layer layer;
+    const char *text;
+    GFont font;
+    GColor text_color;
+    GColor background_color;
+    GTextAlignment alignment;
+};
+
+struct BitmapLayer {
+    Layer layer;
+    const GBitmap *bitmap;
+    GColor background_color;
+    GCompOp compositing_mode;
+};
+
+struct Window {
+    Layer root;
+    WindowHandlers handlers;
+    GColor background_color;
+    bool loaded;
+};
+
+static Window *s_window = NULL;
+static bool s_dirty = false;
+static uint16_t s_frames = 0;
+
+static void layer_init(Layer *layer, GRect frame) {
+    memset(layer, 0, sizeof(Layer));
+    layer->frame = frame;
+    layer->bounds = GRect(0, 0, frame.size.w, frame.size.h);
+}
+
+static void layer_detach_children(Layer *layer) {
+    Layer *child = layer->first_child;
+    while (child) {
+        Layer *next = child->next_sibling;
+        child->parent = NULL;
+        child->next_sibling = NULL;
+        child = next;
+    }
+    layer->first_child = NULL;
+}
+
+Layer *layer_create(GRect frame) {
+    return layer_create_with_data(frame, 0);
+}
+
+Layer *layer_create_with_data(GRect frame, size_t data_size) {
+    Layer *layer = tracked_alloc(sizeof(Layer) + data_size, WATCH_SIZE_LAYER + data_size);
+    if (!layer) {
+        return NULL;
+    }
+
+    layer_init(layer, frame);
+    layer->data = data_size ? layer + 1 : NULL;
+    return layer;
+}
+
+void layer_destroy(Layer *layer) {
+    if (!layer) {
+        return;
+    }
+
+    layer_remove_from_parent(layer);
+    layer_detach_children(layer);
+    tracked_free(layer);
+}
+
+void *layer_get_data(const Layer *layer) {
+    return layer->data;
+}
+
+void layer_mark_dirty(Layer *layer) {
+    s_dirty = true;
+}
+
+void layer_set_update_proc(Layer *layer, LayerUpdateProc update_proc) {
+    layer->update_proc = update_proc;
+}
+
+void layer_set_frame(Layer *layer, GRect frame) {
+    layer->frame = frame;
+    layer->bounds.size = frame.size;
+    s_dirty = true;
+}
+
+GRect layer_get_frame(const Layer *layer) {
+    return layer->frame;
+}
+
+void layer_set_bounds(Layer *layer, GRect bounds) {
+    layer->bounds = bounds;
+    s_dirty = true;
+}
+
+GRect layer_get_bounds(const Layer *layer) {
+    return layer->bounds;
+}
+
+void layer_set_hidden(Layer *layer, bool hidden) {
+    layer->hidden = hidden;
+    s_dirty = true;
+}
+
+bool layer_get_hidden(const Layer *layer) {
+    return layer->hidden;
+}
+
+void layer_add_child(Layer *parent, Layer *child) {
+    layer_remove_from_parent(child);
+
+    child->parent = parent;
+    Layer **link = &parent->first_child;
+    while (*link) {
+        link = &(*link)->next_sibling;
+    }
+    *link = child;
+    s_dirty = true;
+}
+
+void layer_remove_from_parent(Layer *child) {
+    if (!child->parent) {
+        return;
+    }
+
+    Layer **link = &child->parent->first_child;
+    while (*link && *link != child) {
+        link = &(*link)->next_sibling;
+    }
+    if (*link) {
+        *link = child->next_sibling;
+    }
+
+    child->parent = NULL;
+    child->next_sibling = NULL;
+    s_dirty = true;
+}
+
+// Next code point of UTF-8 text, advances text past it
+static uint16_t next_codepoint(const char **text) {
+    const uint8_t *p = (const uint8_t *)*text;
+    uint16_t c = *p++;
+
+    if (c >= 0xE0) {
+        c = (c & 0x0F) << 12 | (p[0] & 0x3F) << 6 | (p[1] & 0x3F);
+        p += 2;
+    } else if (c >= 0xC0) {
+        c = (c & 0x1F) << 6 | (p[0] & 0x3F);
+        p += 1;
+    }
+
+    *text = (const char *)p;
+    return c;
+}
+
+static const StubGlyph *find_glyph(const StubResource *res, uint16_t codepoint) {
+    for (uint16_t i = 0; i < res->glyph_count; i++) {
+        if (res->glyphs[i].codepoint == codepoint) {
+            return &res->glyphs[i];
+        }
+    }
+    return NULL;
+}
+
+// Characters missing from the font are left out, like the firmware does
+static int16_t line_width(const StubResource *res, const char *text) {
+    int16_t width = 0;
+    while (*text && *text != '\n') {
+        const StubGlyph *glyph = find_glyph(res, next_codepoint(&text));
+        width += glyph ? glyph->advance : 0;
+    }
+    return width;
+}
+
+static void draw_glyph(GContext *ctx, const StubResource *res, const StubGlyph *glyph, int16_t x, int16_t y) {
+    const uint8_t *bits = res->glyph_bits + glyph->offset;
+    uint8_t row_size = (glyph->w + 7) / 8;
+
+    for (int16_t row = 0; row < glyph->h; row++) {
+        for (int16_t col = 0; col < glyph->w; col++) {
+            if (bits[row * row_size + col / 8] & (0x80 >> (col & 7))) {
+                put_pixel(ctx, ctx->offset.x + x + glyph->x + col, ctx->offset.y + y + glyph->y + row, ctx->text_color);
+            }
+        }
+    }
+}
+
+// One line per \n, lines are not wrapped
+static void draw_text(GContext *ctx, const char *text, GFont font, GRect box, GTextAlignment alignment) {
+    const StubResource *res = font->resource;
+    int16_t y = box.origin.y;
+
+    while (*text) {
+        int16_t x = box.origin.x;
+        if (alignment == GTextAlignmentCenter) {
+            x += (box.size.w - line_width(res, text)) / 2;
+        } else if (alignment == GTextAlignmentRight) {
+            x += box.size.w - line_width(res, text);
+        }
+
+        while (*text && *text != '\n') {
+            const StubGlyph *glyph = find_glyph(res, next_codepoint(&text));
+            if (glyph) {
+                draw_glyph(ctx, res, glyph, x, y);
+                x += glyph->advance;
+            }
+        }
+
+        if (*text == '\n') {
+            text++;
+        }
+        y += res->height;
+    }
+}
+
+static void text_layer_update_proc(Layer *layer, GContext *ctx) {
+    TextLayer *text_layer = (TextLayer *)layer;
+
+    graphics_context_set_fill_color(ctx, text_layer->background_color);
+    graphics_fill_rect(ctx, layer->bounds, 0, GCornerNone);
+
+    if (text_layer->text && text_layer->font) {
+        graphics_context_set_text_color(ctx, text_layer->text_color);
+        draw_text(ctx, text_layer->text, text_layer->font, layer->bounds, text_layer->alignment);
+    }
+}
+
+TextLayer *text_layer_create(GRect frame) {
+    TextLayer *text_layer = tracked_alloc(sizeof(TextLayer), WATCH_SIZE_TEXT_LAYER);
+    if (!text_layer) {
+        return NULL;
+    }
+
+    layer_init(&text_layer->layer, frame);
+    text_layer->layer.update_proc = text_layer_update_proc;
+    text_layer->text_color = GColorBlack;
+    text_layer->background_color = GColorWhite;
+    return text_layer;
+}
+
+void text_layer_destroy(TextLayer *text_layer) {
+    if (!text_layer) {
+        return;
+    }
+
+    layer_remove_from_parent(&text_layer->layer);
+    layer_detach_children(&text_layer->layer);
+    tracked_free(text_layer);
+}
+
+Layer *text_layer_get_layer(TextLayer *text_layer) {
+    return &text_layer->layer;
+}
+
+void text_layer_set_text(TextLayer *text_layer, const char *text) {
+    text_layer->text = text;
+    s_dirty = true;
+}
+
+const char *text_layer_get_text(TextLayer *text_layer) {
+    return text_layer->text;
+}
+
+void text_layer_set_background_color(TextLayer *text_layer, GColor color) {
+    text_layer->background_color = color;
+    s_dirty = true;
+}
+
+void text_layer_set_text_color(TextLayer *text_layer, GColor color) {
+    text_layer->text_color = color;
+    s_dirty = true;
+}
+
+void text_layer_set_font(TextLayer *text_layer, GFont font) {
+    text_layer->font = font;
+    s_dirty = true;
+}
+
+void text_layer_set_text_alignment(TextLayer *text_layer, GTextAlignment text_alignment) {
+    text_layer->alignment = text_alignment;
+    s_dirty = true;
+}
+
+static void bitmap_layer_update_proc(Layer *layer, GContext *ctx) {
+    BitmapLayer *bitmap_layer = (BitmapLayer *)layer;
+
+    graphics_context_set_fill_color(ctx, bitmap_layer->background_color);
+    graphics_fill_rect(ctx, layer->bounds, 0, GCornerNone);
+
+    // Centered, as with the default alignment
+    const GBitmap *bitmap = bitmap_layer->bitmap;
+    if (bitmap) {
+        GSize size = bitmap->bounds.size;
+        GRect rect = GRect((layer->bounds.size.w - size.w) / 2, (layer->bounds.size.h - size.h) / 2, size.w, size.h);
+
+        graphics_context_set_compositing_mode(ctx, bitmap_layer->compositing_mode);
+        graphics_draw_bitmap_in_rect(ctx, bitmap, rect);
+        graphics_context_set_compositing_mode(ctx, GCompOpAssign);
+    }
+}
+
+BitmapLayer *bitmap_layer_create(GRect frame) {
+    BitmapLayer *bitmap_layer = tracked_alloc(sizeof(BitmapLayer), WATCH_SIZE_BITMAP_LAYER);
+    if (!bitmap_layer) {
+        return NULL;
+    }
+
+    layer_init(&bitmap_layer->layer, frame);
+    bitmap_layer->layer.update_proc = bitmap_layer_update_proc;
+    bitmap_layer->background_color = GColorClear;
+    return bitmap_layer;
+}
+
+void bitmap_layer_destroy(BitmapLayer *bitmap_layer) {
+    if (!bitmap_layer) {
+        return;
+    }
+
+    layer_remove_from_parent(&bitmap_layer->layer);
+    layer_detach_children(&bitmap_layer->layer);
+    tracked_free(bitmap_layer);
+}
+
+Layer *bitmap_layer_get_layer(const BitmapLayer *bitmap_layer) {
+    return (Layer *)&bitmap_layer->layer;
+}
+
+void bitmap_layer_set_bitmap(BitmapLayer *bitmap_layer, const GBitmap *bitmap) {
+    bitmap_layer->bitmap = bitmap;
+    s_dirty = true;
+}
+
+void bitmap_layer_set_compositing_mode(BitmapLayer *bitmap_layer, GCompOp mode) {
+    bitmap_layer->compositing_mode = mode;
+    s_dirty = true;
+}
+
+Window *window_create(void) {
+    Window *window = tracked_alloc(sizeof(Window), WATCH_SIZE_WINDOW);
+    if (!window) {
+        return NULL;
+    }
+
+    layer_init(&window->root, GRect(0, 0, STUB_SCREEN_WIDTH, STUB_SCREEN_HEIGHT));
+    window->background_color = GColorWhite;
+    return window;
+}
+
+void window_destroy(Window *window) {
+    if (!window) {
+        return;
+    }
+
+    if (window == s_window) {
+        stub_unload_window();
+        s_window = NULL;
+    }
+
+    layer_detach_children(&window->root);
+    tracked_free(window);
+}
+
+void window_set_window_handlers(Window *window, WindowHandlers handlers) {
+    window->handlers = handlers;
+}
+
+void window_set_background_color(Window *window, GColor background_color) {
+    window->background_color = background_color;
+    s_dirty = true;
+}
+
+Layer *window_get_root_layer(const Window *window) {
+    return (Layer *)&window->root;
+}
+
+void window_stack_push(Window *window, bool animated) {
+    s_window = window;
+    stub_load_window();
+}
+
+void stub_unload_window(void) {
+    if (!s_window || !s_window->loaded) {
+        return;
+    }
+
+    s_window->loaded = false;
+    if (s_window->handlers.unload) {
+        s_window->handlers.unload(s_window);
+    }
+}
+
+void stub_load_window(void) {
+    if (!s_window || s_window->loaded) {
+        return;
+    }
+
+    s_window->loaded = true;
+    if (s_window->handlers.load) {
+        s_window->handlers.load(s_window);
+    }
+    s_dirty = true;
+}
+
+static void draw_layer(Layer *layer, GPoint parent_origin, GRect parent_clip) {
+    if (layer->hidden) {
+        return;
+    }
+
+    GPoint origin = GPoint(parent_origin.x + layer->frame.origin.x, parent_origin.y + layer->frame.origin.y);
+    GRect clip = GRect(origin.x, origin.y, layer->frame.size.w, layer->frame.size.h);
+    grect_clip(&clip, &parent_clip);
+
+    if (layer->update_proc) {
+        s_context.offset = GPoint(origin.x + layer->bounds.origin.x, origin.y + layer->bounds.origin.y);
+        s_context.clip = clip;
+        layer->update_proc(layer, &s_context);
+
+        if (s_context.captured) {
+            fprintf(stderr, "stub: frame buffer is still captured after an update proc\n");
+            abort();
+        }
+    }
+
+    for (Layer *child = layer->first_child; child; child = child->next_sibling) {
+        draw_layer(child, origin, clip);
+    }
+}
+
+void stub_render(void) {
+    s_dirty = false;
+
+    if (!s_window || !s_window->loaded) {
+        return;
+    }
+
+    GRect screen = GRect(0, 0, STUB_SCREEN_WIDTH, STUB_SCREEN_HEIGHT);
+
+    s_context.offset = GPointZero;
+    s_context.clip = screen;
+    graphics_context_set_fill_color(&s_context, s_window->background_color);
+    graphics_fill_rect(&s_context, screen, 0, GCornerNone);
+
+    draw_layer(&s_window->root, GPointZero, screen);
+    s_frames += 1;
+}
+
+uint16_t stub_frames_rendered(void) {
+    return s_frames;
+}
+
+static void (*s_event_loop)(void) = NULL;
+
+void stub_set_event_loop(void (*loop)(void)) {
+    s_event_loop = loop;
+}
+
+void app_event_loop(void) {
+    if (s_event_loop) {
+        s_event_loop();
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Animation and timers
+
+struct AppTimer {
+    AppTimer *next;
+    uint64_t due_ms;
+    AppTimerCallback callback;
+    void *data;
+};
+
+struct Animation {
+    Animation *next;
+    uint32_t duration_ms;
+    uint32_t delay_ms;
+    AnimationCurve curve;
+    bool reverse;
+    const AnimationImplementation *implementation;
+    AnimationHandlers handlers;
+    void *context;
+    bool scheduled;
+    bool started;
+    bool destroying;
+    uint64_t start_ms;
+    uint64_t next_frame_ms;
+};
+
+static AppTimer *s_timers = NULL;
+static Animation *s_animations = NULL;
+
+static bool unlink_timer(AppTimer *timer) {
+    for (AppTimer **link = &s_timers; *link; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            return true;
+        }
+    }
+    return false;
+}
+
+AppTimer *app_timer_register(uint32_t timeout_ms, AppTimerCallback callback, void *callback_data) {
+    AppTimer *timer = tracked_alloc(sizeof(AppTimer), WATCH_SIZE_APP_TIMER);
+    if (!timer) {
+        return NULL;
+    }
+
+    timer->due_ms = s_now_ms + timeout_ms;
+    timer->callback = callback;
+    timer->data = callback_data;
+    timer->next = s_timers;
+    s_timers = timer;
+    return timer;
+}
+
+bool app_timer_reschedule(AppTimer *timer_handle, uint32_t new_timeout_ms) {
+    for (AppTimer *timer = s_timers; timer; timer = timer->next) {
+        if (timer == timer_handle) {
+            timer->due_ms = s_now_ms + new_timeout_ms;
+            return true;
+        }
+    }
+    return false;
+}
+
+void app_timer_cancel(AppTimer *timer_handle) {
+    if (timer_handle && unlink_timer(timer_handle)) {
+        tracked_free(timer_handle);
+    }
+}
+
+size_t stub_timers_pending(void) {
+    size_t count = 0;
+    for (AppTimer *timer = s_timers; timer; timer = timer->next) {
+        count += 1;
+    }
+    return count;
+}
+
+Animation *animation_create(void) {
+    Animation *animation = tracked_alloc(sizeof(Animation), WATCH_SIZE_ANIMATION);
+    if (animation) {
+        animation->duration_ms = 250;
+        animation->curve = AnimationCurveEaseInOut;
+    }
+    return animation;
+}
+
+bool animation_set_duration(Animation *animation, uint32_t duration_ms) {
+    animation->duration_ms = duration_ms;
+    return true;
+}
+
+bool animation_set_delay(Animation *animation, uint32_t delay_ms) {
+    animation->delay_ms = delay_ms;
+    return true;
+}
+
+bool animation_set_curve(Animation *animation, AnimationCurve curve) {
+    animation->curve = curve;
+    return true;
+}
+
+bool animation_set_reverse(Animation *animation, bool reverse) {
+    animation->reverse = reverse;
+    return true;
+}
+
+bool animation_set_implementation(Animation *animation, const AnimationImplementation *implementation) {
+    animation->implementation = implementation;
+    return true;
+}
+
+bool animation_set_handlers(Animation *animation, AnimationHandlers callbacks, void *context) {
+    animation->handlers = callbacks;
+    animation->context = context;
+    return true;
+}
+
+void *animation_get_context(Animation *animation) {
+    return animation->context;
+}
+
+bool animation_schedule(Animation *animation) {
+    if (animation->scheduled) {
+        return false;
+    }
+
+    animation->scheduled = true;
+    animation->started = false;
+    animation->start_ms = s_now_ms + animation->delay_ms;
+    animation->next_frame_ms = animation->start_ms;
+    animation->next = s_animations;
+    s_animations = animation;
+    return true;
+}
+
+static void stop(Animation *animation, bool finished) {
+    for (Animation **link = &s_animations; *link; link = &(*link)->next) {
+        if (*link == animation) {
+            *link = animation->next;
+            break;
+        }
+    }
+
+    animation->scheduled = false;
+
+    // Handler is allowed to destroy the animation, nothing touches it afterwards
+    if (animation->handlers.stopped) {
+        animation->handlers.stopped(animation, finished, animation->context);
+    }
+}
+
+bool animation_unschedule(Animation *animation) {
+    if (!animation || !animation->scheduled) {
+        return false;
+    }
+
+    stop(animation, false);
+    return true;
+}
+
+bool animation_is_scheduled(Animation *animation) {
+    return animation && animation->scheduled;
+}
+
+bool animation_destroy(Animation *animation) {
+    if (!animation || animation->destroying) {
+        return false;
+    }
+
+    animation->destroying = true;
+    if (animation->scheduled) {
+        stop(animation, false);
+    }
+
+    tracked_free(animation);
+    return true;
+}
+
+size_t stub_animations_scheduled(void) {
+    size_t count = 0;
+    for (Animation *animation = s_animations; animation; animation = animation->next) {
+        count += 1;
+    }
+    return count;
+}
+
+static uint32_t curve(AnimationCurve curve, uint32_t t) {
+    const uint32_t max = ANIMATION_NORMALIZED_MAX;
+
+    switch (curve) {
+        case AnimationCurveEaseIn:
+            return t * t / max;
+        case AnimationCurveEaseOut:
+            return max - (max - t) * (max - t) / max;
+        case AnimationCurveEaseInOut:
+            if (t < max / 2) {
+                return 2 * t * t / max;
+            }
+            return max - 2 * (max - t) * (max - t) / max;
+        default:
+            return t;
+    }
+}
+
+static void animation_frame(Animation *animation) {
+    if (!animation->started) {
+        animation->started = true;
+        if (animation->implementation && animation->implementation->setup) {
+            animation->implementation->setup(animation);
+        }
+        if (animation->handlers.started) {
+            animation->handlers.started(animation, animation->context);
+        }
+        if (!animation->scheduled) {
+            return;
+        }
+    }
+
+    uint64_t elapsed = s_now_ms - animation->start_ms;
+    bool finished = elapsed >= animation->duration_ms;
+    uint32_t t = finished ? ANIMATION_NORMALIZED_MAX : elapsed * ANIMATION_NORMALIZED_MAX / animation->duration_ms;
+
+    AnimationProgress progress = curve(animation->curve, t);
+    if (animation->reverse) {
+        progress = ANIMATION_NORMALIZED_MAX - progress;
+    }
+
+    animation->next_frame_ms = s_now_ms + FRAME_INTERVAL_MS;
+
+    if (animation->implementation && animation->implementation->update) {
+        animation->implementation->update(animation, progress);
+    }
+
+    if (finished && animation->scheduled) {
+        stop(animation, true);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Event services
+
+static TickHandler s_tick_handler = NULL;
+static TimeUnits s_tick_units = 0;
+static BatteryStateHandler s_battery_handler = NULL;
+static BluetoothConnectionHandler s_bluetooth_handler = NULL;
+static AccelTapHandler s_tap_handler = NULL;
+static bool s_bluetooth_connected = true;
+
+void tick_timer_service_subscribe(TimeUnits tick_units, TickHandler handler) {
+    s_tick_units = tick_units;
+    s_tick_handler = handler;
+}
+
+void tick_timer_service_unsubscribe(void) {
+    s_tick_handler = NULL;
+}
+
+void battery_state_service_subscribe(BatteryStateHandler handler) {
+    s_battery_handler = handler;
+}
+
+void battery_state_service_unsubscribe(void) {
+    s_battery_handler = NULL;
+}
+
+BatteryChargeState battery_state_service_peek(void) {
+    return (BatteryChargeState) {
+        .charge_percent = 80
+    };
+}
+
+void bluetooth_connection_service_subscribe(BluetoothConnectionHandler handler) {
+    s_bluetooth_handler = handler;
+}
+
+void bluetooth_connection_service_unsubscribe(void) {
+    s_bluetooth_handler = NULL;
+}
+
+bool bluetooth_connection_service_peek(void) {
+    return s_bluetooth_connected;
+}
+
+void stub_set_bluetooth(bool connected) {
+    s_bluetooth_connected = connected;
+    if (s_bluetooth_handler) {
+        s_bluetooth_handler(connected);
+    }
+}
+
+void accel_tap_service_subscribe(AccelTapHandler handler) {
+    s_tap_handler = handler;
+}
+
+void accel_tap_service_unsubscribe(void) {
+    s_tap_handler = NULL;
+}
+
+void stub_tap(void) {
+    if (s_tap_handler) {
+        s_tap_handler(ACCEL_AXIS_Z, 1);
+    }
+}
+
+void vibes_enqueue_custom_pattern(VibePattern pattern) {
+}
+
+#if defined(PBL_HEALTH)
+static bool s_steps_available = false;
+static int32_t s_steps = 0;
+
+HealthServiceAccessibilityMask health_service_metric_accessible(HealthMetric metric, time_t time_start, time_t time_end) {
+    return s_steps_available ? HealthServiceAccessibilityMaskAvailable : HealthServiceAccessibilityMaskNoPermission;
+}
+
+HealthValue health_service_sum_today(HealthMetric metric) {
+    return s_steps_available ? s_steps : 0;
+}
+
+bool health_service_events_subscribe(HealthEventHandler handler, void *context) {
+    return true;
+}
+
+bool health_service_events_unsubscribe(void) {
+    return true;
+}
+#endif
+
+void stub_set_steps(bool available, int32_t steps) {
+#if defined(PBL_HEALTH)
+    s_steps_available = available;
+    s_steps = steps;
+#endif
+}
+
+static uint64_t next_tick_ms(void) {
+    uint64_t period = s_tick_units & SECOND_UNIT ? 1000 : 60 * 1000;
+    return (s_now_ms / period + 1) * period;
+}
+
+static void tick(void) {
+    time_t now = s_now_ms / 1000;
+    struct tm *tick_time = localtime(&now);
+
+    TimeUnits units = SECOND_UNIT;
+    if (tick_time->tm_sec == 0) {
+        units |= MINUTE_UNIT;
+        if (tick_time->tm_min == 0) {
+            units |= HOUR_UNIT;
+            if (tick_time->tm_hour == 0) {
+                units |= DAY_UNIT;
+            }
+        }
+    }
+
+    if (units & s_tick_units) {
+        s_tick_handler(tick_time, units);
+    }
+}
+
+// One event at a time, redrawing after each like the watch does
+void stub_advance_ms(uint32_t ms) {
+    uint64_t target = s_now_ms + ms;
+
+    if (s_dirty) {
+        stub_render();
+    }
+
+    for (;;) {
+        AppTimer *timer = NULL;
+        for (AppTimer *t = s_timers; t; t = t->next) {
+            if (!timer || t->due_ms < timer->due_ms) {
+                timer = t;
+            }
+        }
+
+        Animation *animation = NULL;
+        for (Animation *a = s_animations; a; a = a->next) {
+            if (!animation || a->next_frame_ms < animation->next_frame_ms) {
+                animation = a;
+            }
+        }
+
+        uint64_t tick_ms = s_tick_handler ? next_tick_ms() : UINT64_MAX;
+        uint64_t timer_ms = timer ? timer->due_ms : UINT64_MAX;
+        uint64_t frame_ms = animation ? animation->next_frame_ms : UINT64_MAX;
+        uint64_t next = MIN(tick_ms, MIN(timer_ms, frame_ms));
+
+        if (next > target) {
+            break;
+        }
+
+        if (next > s_now_ms) {
+            s_now_ms = next;
+        }
+
+        if (next == timer_ms) {
+            unlink_timer(timer);
+            AppTimerCallback callback = timer->callback;
+            void *data = timer->data;
+            tracked_free(timer);
+            callback(data);
+        } else if (next == frame_ms) {
+            animation_frame(animation);
+        } else {
+            tick();
+        }
+
+        if (s_dirty) {
+            stub_render();
+        }
+    }
+
+    s_now_ms = target;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Dictionaries
+
+#define TUPLE_HEADER_SIZE 7
+
+uint32_t dict_calc_buffer_size(const uint8_t tuple_count, ...) {
+    uint32_t size = sizeof(Dictionary) + tuple_count * TUPLE_HEADER_SIZE;
+
+    va_list args;
+    va_start(args, tuple_count);
+    for (int i = 0; i < tuple_count; i++) {
+        size += va_arg(args, uint32_t);
+    }
+    va_end(args);
+
+    return size;
+}
+
+DictionaryResult dict_write_begin(DictionaryIterator *iter, uint8_t * const buffer, const uint16_t size) {
+    if (!iter || !buffer || size < sizeof(Dictionary)) {
+        return DICT_INVALID_ARGS;
+    }
+
+    iter->dictionary = (Dictionary *)buffer;
+    iter->dictionary->count = 0;
+    iter->end = buffer + size;
+    iter->cursor = iter->dictionary->head;
+    return DICT_OK;
+}
+
+static uint16_t s_outbox_overflows = 0;
+static uint8_t *s_outbox_buffer = NULL;
+
+static DictionaryResult write_tuple(DictionaryIterator *iter, uint32_t key, TupleType type, const void *data, uint16_t length) {
+    uint8_t *cursor = (uint8_t *)iter->cursor;
+
+    if (cursor + TUPLE_HEADER_SIZE + length > (const uint8_t *)iter->end) {
+        if ((uint8_t *)iter->dictionary == s_outbox_buffer) {
+            s_outbox_overflows += 1;
+        }
+        return DICT_NOT_ENOUGH_STORAGE;
+    }
+
+    Tuple *tuple = iter->cursor;
+    tuple->key = key;
+    tuple->type = type;
+    tuple->length = length;
+    memcpy(tuple->value->data, data, length);
+
+    iter->cursor = (Tuple *)(cursor + TUPLE_HEADER_SIZE + length);
+    iter->dictionary->count += 1;
+    return DICT_OK;
+}
+
+DictionaryResult dict_write_data(DictionaryIterator *iter, const uint32_t key, const uint8_t * const data, const uint16_t size) {
+    return write_tuple(iter, key, TUPLE_BYTE_ARRAY, data, size);
+}
+
+DictionaryResult dict_write_cstring(DictionaryIterator *iter, const uint32_t key, const char * const cstring) {
+    return write_tuple(iter, key, TUPLE_CSTRING, cstring, strlen(cstring) + 1);
+}
+
+DictionaryResult dict_write_uint8(DictionaryIterator *iter, const uint32_t key, const uint8_t value) {
+    return write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint16(DictionaryIterator *iter, const uint32_t key, const uint16_t value) {
+    return write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_uint32(DictionaryIterator *iter, const uint32_t key, const uint32_t value) {
+    return write_tuple(iter, key, TUPLE_UINT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int8(DictionaryIterator *iter, const uint32_t key, const int8_t value) {
+    return write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+DictionaryResult dict_write_int32(DictionaryIterator *iter, const uint32_t key, const int32_t value) {
+    return write_tuple(iter, key, TUPLE_INT, &value, sizeof(value));
+}
+
+uint32_t dict_write_end(DictionaryIterator *iter) {
+    uint32_t size = (uint8_t *)iter->cursor - (uint8_t *)iter->dictionary;
+    iter->end = iter->cursor;
+    return size;
+}
+
+Tuple *dict_read_begin_from_buffer(DictionaryIterator *iter, const uint8_t * const buffer, const uint16_t size) {
+    iter->dictionary = (Dictionary *)buffer;
+    iter->end = buffer + size;
+    return dict_read_first(iter);
+}
+
+static Tuple *tuple_after(const Tuple *tuple) {
+    return (Tuple *)((const uint8_t *)tuple + TUPLE_HEADER_SIZE + tuple->length);
+}
+
+// Tuples are read up to the count in the header and never past the end
+static bool tuple_valid(const DictionaryIterator *iter, const Tuple *tuple, uint8_t index) {
+    return index < iter->dictionary->count
+        && (const uint8_t *)tuple + TUPLE_HEADER_SIZE <= (const uint8_t *)iter->end
+        && (const uint8_t *)tuple_after(tuple) <= (const uint8_t *)iter->end;
+}
+
+Tuple *dict_read_first(DictionaryIterator *iter) {
+    iter->cursor = iter->dictionary->head;
+    return tuple_valid(iter, iter->cursor, 0) ? iter->cursor : NULL;
+}
+
+Tuple *dict_read_next(DictionaryIterator *iter) {
+    uint8_t index = 0;
+    for (Tuple *t = iter->dictionary->head; t != iter->cursor; t = tuple_after(t)) {
+        index += 1;
+    }
+
+    Tuple *next = tuple_after(iter->cursor);
+    if (!tuple_valid(iter, next, index + 1)) {
+        return NULL;
+    }
+
+    iter->cursor = next;
+    return next;
+}
+
+Tuple *dict_find(const DictionaryIterator *iter, const uint32_t key) {
+    Tuple *tuple = iter->dictionary->head;
+    for (uint8_t i = 0; tuple_valid(iter, tuple, i); i++, tuple = tuple_after(tuple)) {
+        if (tuple->key == key) {
+            return tuple;
+        }
+    }
+    return NULL;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// AppMessage
+
+static uint8_t *s_inbox_buffer = NULL;
+static uint16_t s_inbox_size = 0;
+static uint16_t s_outbox_size = 0;
+static DictionaryIterator s_outbox_iter;
+static bool s_outbox_writing = false;
+static bool s_outbox_busy = false;
+static uint16_t s_outbox_sends = 0;
+static AppMessageInboxReceived s_inbox_received = NULL;
+static AppMessageOutboxSent s_outbox_sent = NULL;
+static AppMessageOutboxFailed s_outbox_failed = NULL;
+
+AppMessageResult app_message_open(const uint32_t size_inbound, const uint32_t size_outbound) {
+    if (s_inbox_buffer) {
+        return APP_MSG_INVALID_STATE;
+    }
+
+    s_inbox_buffer = tracked_alloc(size_inbound, size_inbound);
+    s_outbox_buffer = tracked_alloc(size_outbound, size_outbound);
+    if (!s_inbox_buffer || !s_outbox_buffer) {
+        return APP_MSG_OUT_OF_MEMORY;
+    }
+
+    s_inbox_size = size_inbound;
+    s_outbox_size = size_outbound;
+    return APP_MSG_OK;
+}
+
+void app_message_deregister_callbacks(void) {
+    s_inbox_received = NULL;
+    s_outbox_sent = NULL;
+    s_outbox_failed = NULL;
+}
+
+AppMessageInboxReceived app_message_register_inbox_received(AppMessageInboxReceived received_callback) {
+    AppMessageInboxReceived previous = s_inbox_received;
+    s_inbox_received = received_callback;
+    return previous;
+}
+
+AppMessageOutboxSent app_message_register_outbox_sent(AppMessageOutboxSent sent_callback) {
+    AppMessageOutboxSent previous = s_outbox_sent;
+    s_outbox_sent = sent_callback;
+    return previous;
+}
+
+AppMessageOutboxFailed app_message_register_outbox_failed(AppMessageOutboxFailed failed_callback) {
+    AppMessageOutboxFailed previous = s_outbox_failed;
+    s_outbox_failed = failed_callback;
+    return previous;
+}
+
+AppMessageResult app_message_outbox_begin(DictionaryIterator **iterator) {
+    if (!s_outbox_buffer) {
+        return APP_MSG_INVALID_STATE;
+    }
+
+    if (s_outbox_busy || s_outbox_writing) {
+        return APP_MSG_BUSY;
+    }
+
+    dict_write_begin(&s_outbox_iter, s_outbox_buffer, s_outbox_size);
+    s_outbox_writing = true;
+    *iterator = &s_outbox_iter;
+    return APP_MSG_OK;
+}
+
+AppMessageResult app_message_outbox_send(void) {
+    if (!s_outbox_writing) {
+        return APP_MSG_INVALID_STATE;
+    }
+
+    s_outbox_writing = false;
+    s_outbox_busy = true;
+    s_outbox_sends += 1;
+    return APP_MSG_OK;
+}
+
+bool stub_outbox_busy(void) {
+    return s_outbox_busy;
+}
+
+DictionaryIterator *stub_outbox(void) {
+    if (!s_outbox_busy) {
+        return NULL;
+    }
+
+    dict_read_begin_from_buffer(&s_outbox_iter, s_outbox_buffer, s_outbox_size);
+    return &s_outbox_iter;
+}
+
+uint16_t stub_outbox_size(void) {
+    return s_outbox_size;
+}
+
+void stub_outbox_complete(AppMessageResult result) {
+    if (!s_outbox_busy) {
+        return;
+    }
+
+    DictionaryIterator *iter = stub_outbox();
+    s_outbox_busy = false;
+
+    if (result == APP_MSG_OK) {
+        if (s_outbox_sent) {
+            s_outbox_sent(iter, NULL);
+        }
+    } else if (s_outbox_failed) {
+        s_outbox_failed(iter, result, NULL);
+    }
+}
+
+uint16_t stub_outbox_overflows(void) {
+    return s_outbox_overflows;
+}
+
+uint16_t stub_outbox_sends(void) {
+    return s_outbox_sends;
+}
+
+bool stub_inbox_receive(const uint8_t *buffer, uint16_t size) {
+    if (!s_inbox_buffer || size > s_inbox_size) {
+        return false;
+    }
+
+    memcpy(s_inbox_buffer, buffer, size);
+
+    DictionaryIterator iter;
+    dict_read_begin_from_buffer(&iter, s_inbox_buffer, size);
+    if (s_inbox_received) {
+        s_inbox_received(&iter, NULL);
+    }
+    return true;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Persistent storage
+
+#define PERSIST_MAX_KEYS 64
+
+typedef struct {
+    bool used;
+    uint32_t key;
+    uint16_t size;
+    uint8_t data[PERSIST_DATA_MAX_LENGTH];
+} PersistEntry;
+
+static PersistEntry s_persist[PERSIST_MAX_KEYS];
+static uint32_t s_persist_writes = 0;
+static uint32_t s_persist_bytes_written = 0;
+
+static PersistEntry *find_entry(uint32_t key) {
+    for (int i = 0; i < PERSIST_MAX_KEYS; i++) {
+        if (s_persist[i].used && s_persist[i].key == key) {
+            return &s_persist[i];
+        }
+    }
+    return NULL;
+}
+
+size_t stub_persist_total(void) {
+    size_t total = 0;
+    for (int i = 0; i < PERSIST_MAX_KEYS; i++) {
+        if (s_persist[i].used) {
+            total += s_persist[i].size;
+        }
+    }
+    return total;
+}
+
+bool persist_exists(const uint32_t key) {
+    return find_entry(key) != NULL;
+}
+
+int persist_get_size(const uint32_t key) {
+    PersistEntry *entry = find_entry(key);
+    return entry ? entry->size : E_DOES_NOT_EXIST;
+}
+
+int32_t persist_read_int(const uint32_t key) {
+    int32_t value = 0;
+    persist_read_data(key, &value, sizeof(value));
+    return value;
+}
+
+int persist_read_data(const uint32_t key, void *buffer, const size_t buffer_size) {
+    PersistEntry *entry = find_entry(key);
+    if (!entry) {
+        return E_DOES_NOT_EXIST;
+    }
+
+    size_t size = MIN(buffer_size, entry->size);
+    memcpy(buffer, entry->data, size);
+    return size;
+}
+
+status_t persist_write_bool(const uint32_t key, const bool value) {
+    int written = persist_write_data(key, &value, sizeof(value));
+    return written < 0 ? written : S_SUCCESS;
+}
+
+status_t persist_write_int(const uint32_t key, const int32_t value) {
+    int written = persist_write_data(key, &value, sizeof(value));
+    return written < 0 ? written : S_SUCCESS;
+}
+
+int persist_write_data(const uint32_t key, const void *data, const size_t size) {
+    size_t length = MIN(size, PERSIST_DATA_MAX_LENGTH);
+    PersistEntry *entry = find_entry(key);
+    size_t others = stub_persist_total() - (entry ? entry->size : 0);
+
+    if (others + length > STUB_PERSIST_QUOTA) {
+        return E_OUT_OF_STORAGE;
+    }
+
+    if (!entry) {
+        for (int i = 0; i < PERSIST_MAX_KEYS && !entry; i++) {
+            if (!s_persist[i].used) {
+                entry = &s_persist[i];
+            }
+        }
+        if (!entry) {
+            return E_OUT_OF_RESOURCES;
+        }
+    }
+
+    entry->used = true;
+    entry->key = key;
+    entry->size = length;
+    memcpy(entry->data, data, length);
+
+    s_persist_writes += 1;
+    s_persist_bytes_written += length;
+    return length;
+}
+
+status_t persist_delete(const uint32_t key) {
+    PersistEntry *entry = find_entry(key);
+    if (!entry) {
+        return E_DOES_NOT_EXIST;
+    }
+
+    entry->used = false;
+    return S_SUCCESS;
+}
+
+uint32_t stub_persist_writes(void) {
+    return s_persist_writes;
+}
+
+uint32_t stub_persist_bytes_written(void) {
+    return s_persist_bytes_written;
+}
+
+void stub_persist_clear(void) {
+    memset(s_persist, 0, sizeof(s_persist));
+    s_persist_writes = 0;
+    s_persist_bytes_written = 0;
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+// Background worker
+
+static bool s_worker_running = false;
+static AppWorkerMessageHandler s_worker_handler = NULL;
+static uint32_t s_worker_launches = 0;
+
+bool app_worker_is_running(void) {
+    return s_worker_running;
+}
+
+AppWorkerResult app_worker_launch(void) {
+    s_worker_launches += 1;
+    return s_worker_running ? APP_WORKER_RESULT_ALREADY_RUNNING : APP_WORKER_RESULT_SUCCESS;
+}
+
+bool app_worker_message_subscribe(AppWorkerMessageHandler handler) {
+    s_worker_handler = handler;
+    return true;
+}
+
+bool app_worker_message_unsubscribe(void) {
+    s_worker_handler = NULL;
+    return true;
+}
+
+void app_worker_send_message(uint8_t type, AppWorkerMessage *data) {
+}
+
+void stub_set_worker_running(bool running) {
+    s_worker_running = running;
+}
+
+uint32_t stub_worker_launches(void) {
+    return s_worker_launches;
+}
+
+void stub_send_worker_message(uint16_t type, AppWorkerMessage *data) {
+    if (s_worker_handler) {
+        s_worker_handler(type, data);
+    }
+}
+
+// - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - - //
+
+void stub_reset(void) {
+    while (s_timers) {
+        AppTimer *timer = s_timers;
+        s_timers = timer->next;
+        tracked_free(timer);
+    }
+
+    while (s_animations) {
+        Animation *animation = s_animations;
+        s_animations = animation->next;
+        tracked_free(animation);
+    }
+
+    s_outbox_writing = false;
+    s_outbox_busy = false;
+    s_outbox_sends = 0;
+    s_outbox_overflows = 0;
+    app_message_deregister_callbacks();
+
+    s_window = NULL;
+    s_dirty = false;
+    s_frames = 0;
+    s_context.captured = false;
+    memset(s_frame_data, 0, sizeof(s_frame_data));
+
+    s_tick_handler = NULL;
+    s_battery_handler = NULL;
+    s_bluetooth_handler = NULL;
+    s_tap_handler = NULL;
+    s_bluetooth_connected = true;
+    s_worker_running = false;
+    s_worker_handler = NULL;
+    s_worker_launches = 0;
+    stub_set_steps(false, 0);
+    stub_set_rand_step(0);
+
+    stub_setup();
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <pebble.h>
+
+// Test side of the SDK stub: drives the virtual clock and events,
+// looks into the heap, the outbox and persistent storage.
+
+#define STUB_SCREEN_WIDTH 144
+#define STUB_SCREEN_HEIGHT 168
+
+// Forgets everything except heap counters and persistent storage,
+// call before every test case. AppMessage stays open: like on the watch
+// it is opened once and the app keeps that in a static.
+void stub_reset(void);
+
+// Logs below this level are printed, nothing is printed by default
+void stub_set_log_level(uint8_t level);
+
+// Heap. SDK objects are charged what they take on the watch, app
+// allocations what they take here (a bit more, pointers are 64 bit).
+// Every block also pays the allocator header the watch heap has.
+size_t stub_heap_peak(void);
+void stub_heap_reset_peak(void);
+size_t stub_heap_blocks(void);
+
+// Virtual clock. Advancing it fires due timers, animation frames and
+// minute ticks in order, and redraws the window after every event that
+// marked something dirty, the way the event loop on the watch does.
+uint64_t stub_now_ms(void);
+void stub_set_time(time_t secs);
+void stub_advance_ms(uint32_t ms);
+void stub_render(void);
+uint16_t stub_frames_rendered(void);
+GBitmap *stub_frame_buffer(void);
+size_t stub_timers_pending(void);
+size_t stub_animations_scheduled(void);
+
+// rand() returns step, 2 * step, ... when step is not 0, libc rand() otherwise
+void stub_set_rand_step(int step);
+
+// Body of app_event_loop(), runs with the app initialized
+void stub_set_event_loop(void (*loop)(void));
+
+// Window pushed by the app, unloaded and loaded again like the system does
+void stub_unload_window(void);
+void stub_load_window(void);
+
+// Services
+void stub_set_bluetooth(bool connected);
+void stub_set_worker_running(bool running);
+uint32_t stub_worker_launches(void); // since stub_reset(), the worker itself never runs
+void stub_set_steps(bool available, int32_t steps);
+void stub_send_worker_message(uint16_t type, AppWorkerMessage *data);
+void stub_tap(void);
+
+// Outbox: the message passed to app_message_outbox_send() stays there
+// until the test completes it. Writes past the outbox size are counted.
+bool stub_outbox_busy(void);
+DictionaryIterator *stub_outbox(void);
+uint16_t stub_outbox_size(void);
+void stub_outbox_complete(AppMessageResult result);
+uint16_t stub_outbox_overflows(void);
+uint16_t stub_outbox_sends(void);
+
+// Hands a serialized dictionary to the inbox handler, false if it does not fit
+bool stub_inbox_receive(const uint8_t *buffer, uint16_t size);
+
+// Persistent storage. Quota is the same 4 KB as on the watch.
+#define STUB_PERSIST_QUOTA 4096
+size_t stub_persist_total(void);
+uint32_t stub_persist_writes(void);
+uint32_t stub_persist_bytes_written(void);
+void stub_persist_clear(void);
@@ -0,0 +1,232 @@
+// The face is built here as is, quirks the SDK build does not warn about included
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+#pragma GCC diagnostic ignored "-Wduplicate-decl-specifier"
+#define main face_main
+#include "akbble.c"
+#undef main
+#pragma GCC diagnostic pop
+
+#include "test.h"
+
+// Lets startup run all its stages and the first fetch go out
+static void settle(void) {
+    stub_advance_ms(2000);
+}
+
+static void check_heap_budget_after_load(void) {
+    settle();
+
+    CHECK(startup_is_done());
+#if PROFILE_ANIMATIONS
+    CHECK(s_timeline == NULL);
+#endif
+    printf("  heap after load: %u (peak %u) of %u budget\n",
+            (unsigned int)heap_bytes_used(), (unsigned int)stub_heap_peak(), (unsigned int)PROFILE_HEAP_BUDGET);
+    CHECK(heap_bytes_used() <= PROFILE_HEAP_BUDGET);
+}
+
+#if PROFILE_ANIMATIONS
+// Bands and the image of the animation are part of the budget too
+static void check_heap_budget_while_animating(void) {
+    settle();
+
+    CHECK(s_timeline != NULL);
+    printf("  heap while animating: %u (peak %u) of %u budget\n",
+            (unsigned int)heap_bytes_used(), (unsigned int)stub_heap_peak(), (unsigned int)PROFILE_HEAP_BUDGET);
+    CHECK(stub_heap_peak() <= PROFILE_HEAP_BUDGET);
+}
+#endif
+
+static uint32_t s_phone_uuid = 5000;
+
+// Phone sends a command, writer adds whatever else goes into the message
+static void phone_sends(uint8_t cmd, void (*writer)(DictionaryIterator *iter)) {
+    uint8_t buffer[PROFILE_INBOX_SIZE];
+    DictionaryIterator iter;
+
+    dict_write_begin(&iter, buffer, sizeof(buffer));
+    dict_write_uint8(&iter, MSG_KEY_CMD, cmd);
+    dict_write_uint32(&iter, MSG_KEY_UUID, ++s_phone_uuid);
+    dict_write_uint8(&iter, MSG_KEY_PROTO, MQ_PROTO_VERSION);
+    if (writer) {
+        writer(&iter);
+    }
+
+    CHECK(stub_inbox_receive(buffer, dict_write_end(&iter)));
+}
+
+// Phone takes everything the face sends for a while, fragments of
+// payload_cmd are collected into payload
+static uint16_t phone_receives(uint8_t payload_cmd, uint8_t *payload, uint16_t capacity) {
+    uint16_t length = 0;
+
+    for (int i = 0; i < 100; i++) {
+        DictionaryIterator *iter = stub_outbox();
+        if (iter) {
+            Tuple *cmd = dict_find(iter, MSG_KEY_CMD);
+            Tuple *data = dict_find(iter, MSG_KEY_FRAG_DATA);
+            if (cmd && cmd->value->uint8 == payload_cmd && data && length + data->length <= capacity) {
+                memcpy(payload + length, data->value->data, data->length);
+                length += data->length;
+            }
+            stub_outbox_complete(APP_MSG_OK);
+        }
+        stub_advance_ms(500);
+    }
+
+    return length;
+}
+
+static void diagnostics_go_out_as_blob(void) {
+    settle();
+
+    char report[DIAGNOSTICS_MAX_LENGTH + 1] = {0};
+    phone_sends(CMD_IN_GET_DIAGNOSTICS, NULL);
+    uint16_t length = phone_receives(CMD_OUT_DIAGNOSTICS, (uint8_t *)report, DIAGNOSTICS_MAX_LENGTH);
+
+    CHECK(length > 0 && length == strlen(s_diagnostics));
+    CHECK(strncmp(report, "startup: first frame ", 21) == 0);
+    CHECK(strstr(report, "heap: used ") != NULL);
+    CHECK(s_diagnostics_request == 0);
+    CHECK(stub_outbox_overflows() == 0);
+}
+
+static void write_forecast_blob(DictionaryIterator *iter) {
+    uint8_t blob[FORECAST_BLOB_HEADER_SIZE + 2 * FORECAST_PACKED_ENTRY_SIZE];
+    uint32_t start = time(NULL);
+
+    for (int b = 0; b < 4; b++) {
+        blob[b] = start >> (8 * b);
+    }
+
+    // temp, condition, humidity for this hour and the next one
+    memcpy(blob + FORECAST_BLOB_HEADER_SIZE, (uint8_t[]) { 21, 2, 80, 19, 1, 70 }, 6);
+
+    dict_write_uint32(iter, MSG_KEY_FRAG_ID, 1);
+    dict_write_uint16(iter, MSG_KEY_FRAG_SEQ, 0);
+    dict_write_uint16(iter, MSG_KEY_FRAG_OFFSET, 0);
+    dict_write_uint16(iter, MSG_KEY_FRAG_TOTAL, sizeof(blob));
+    dict_write_data(iter, MSG_KEY_FRAG_DATA, blob, sizeof(blob));
+}
+
+static void forecast_blob_is_shown(void) {
+    settle();
+
+    phone_sends(CMD_IN_FORECAST, write_forecast_blob);
+    CHECK(s_temp == 21);
+    CHECK(s_weather_icon == 2);
+    CHECK(s_weather_hum == 80);
+    CHECK(forecast_hours_left(time(NULL)) == 2);
+}
+
+#define UNLOAD_CYCLES 2000
+
+// One cycle: load, let startup finish and the animation start, get messages
+// from the phone that nobody takes out of the outbox, unload half way through
+static void load_unload_cycle(int cycle) {
+    stub_load_window();
+
+    // Every other cycle unloads while the animation still waits for its delay
+    stub_advance_ms(cycle % 2 ? 1200 : 1800);
+#if PROFILE_ANIMATIONS
+    CHECK(s_timeline != NULL || s_anim_start_task != NULL);
+#endif
+
+    phone_sends(CMD_IN_GET_DATA_NOT_MODIFIED, NULL);
+    phone_sends(CMD_IN_GET_DIAGNOSTICS, NULL);
+    CHECK(stub_outbox_busy());
+
+    stub_unload_window();
+
+    // Animation is not started again within 20 s
+    stub_advance_ms(21000);
+
+    // Outbox is done with the old message at some point, face is not there
+    if (cycle % 10 == 0) {
+        stub_outbox_complete(APP_MSG_OK);
+    }
+}
+
+static void load_unload_does_not_leak(void) {
+    stub_unload_window();
+    stub_advance_ms(21000);
+
+    // AppMessage buffers and resources of the first load are there to stay
+    size_t baseline = heap_bytes_used();
+    size_t baseline_blocks = stub_heap_blocks();
+    size_t peak = 0;
+    stub_heap_reset_peak();
+
+    for (int cycle = 1; cycle <= UNLOAD_CYCLES; cycle++) {
+        load_unload_cycle(cycle);
+
+        CHECK(heap_bytes_used() == baseline);
+        CHECK(stub_heap_blocks() == baseline_blocks);
+        CHECK(stub_timers_pending() == 0);
+        CHECK(stub_animations_scheduled() == 0);
+
+        // High-water mark is reached in the first cycles and stays there
+        if (cycle == 10) {
+            peak = stub_heap_peak();
+        }
+
+        if (s_failures) {
+            fprintf(stderr, "  failed in cycle %d\n", cycle);
+            break;
+        }
+    }
+
+    printf("  %d load/unload cycles: heap after unload %u, peak %u\n",
+            UNLOAD_CYCLES, (unsigned int)baseline, (unsigned int)stub_heap_peak());
+    CHECK(stub_heap_peak() == peak);
+    CHECK(stub_heap_peak() <= PROFILE_HEAP_BUDGET);
+
+    stub_load_window();
+}
+
+// First launch starts the worker, later ones leave a stopped worker alone
+static void worker_is_launched_once(void) {
+    CHECK(stub_worker_launches() == 1);
+    CHECK(persist_exists(PERSIST_KEY_WORKER_LAUNCHED));
+}
+
+// Without the worker the face asks the phone for data on its own
+static void stopped_worker_stays_stopped(void) {
+    CHECK(stub_worker_launches() == 0);
+
+    // Due right away, as on a launch with nothing stored
+    s_next_fetch_secs = 0;
+    settle();
+    CHECK(stub_outbox_busy());
+    stub_outbox_complete(APP_MSG_OK);
+
+    stub_advance_ms((FETCH_INTERVAL_SECS + 60) * 1000);
+    Tuple *cmd = stub_outbox() ? dict_find(stub_outbox(), MSG_KEY_CMD) : NULL;
+    CHECK(cmd && cmd->value->uint8 == CMD_OUT_GET_DATA);
+}
+
+static void run_face(void (*test)(void), int rand_step) {
+    stub_reset();
+    stub_set_rand_step(rand_step);
+    stub_set_event_loop(test);
+    face_main();
+}
+
+int main(void) {
+    // First rand() % 3 is not 0, no animation
+    run_face(check_heap_budget_after_load, 1);
+#if PROFILE_ANIMATIONS
+    // rand() % 3 is always 0, the animation starts with the face
+    run_face(check_heap_budget_while_animating, 3);
+#endif
+    run_face(diagnostics_go_out_as_blob, 1);
+    run_face(forecast_blob_is_shown, 1);
+    // rand() % 3 is always 0, every load starts the animation
+    run_face(load_unload_does_not_leak, 3);
+    stub_persist_clear();
+    run_face(worker_is_launched_once, 1);
+    run_face(stopped_worker_stays_stopped, 1);
+    return TEST_RESULT();
+}
@@ -0,0 +1,288 @@
+// The face is built here as is, quirks the SDK build does not warn about included
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wreturn-type"
+#pragma GCC diagnostic ignored "-Wformat-truncation"
+#pragma GCC diagnostic ignored "-Wduplicate-decl-specifier"
+#define main face_main
+#include "akbble.c"
+#undef main
+#pragma GCC diagnostic pop
+
+#include "test.h"
+
+#define REGION_SIZE (gbitmap_get_bytes_per_row(stub_frame_buffer()) * (SCR_HEIGHT - DIGIT_HEIGHT))
+
+static uint8_t *region(void) {
+    GBitmap *fb = stub_frame_buffer();
+    return gbitmap_get_data(fb) + DIGIT_HEIGHT * gbitmap_get_bytes_per_row(fb);
+}
+
+// Lets startup run all its stages and the first fetch go out
+static void settle(void) {
+    stub_advance_ms(2000);
+}
+
+static uint8_t chunks_stored(void) {
+    uint8_t n = 0;
+    while (persist_exists(PERSIST_KEY_FRAME_CHUNKS + n)) {
+        n++;
+    }
+    return n;
+}
+
+static size_t frame_bytes_stored(void) {
+    size_t bytes = 0;
+    for (uint8_t n = 0; n < chunks_stored(); n++) {
+        bytes += persist_get_size(PERSIST_KEY_FRAME_CHUNKS + n);
+    }
+    return bytes;
+}
+
+// Saved by the face itself from the last layer, the way it does it on the watch
+static void save_frame(void) {
+    s_frame_snapshot_due = true;
+    layer_mark_dirty(s_bt_layer);
+    stub_advance_ms(100);
+}
+
+// Other keys as big as they get, they share the quota with the frame
+static void fill_other_keys(void) {
+    uint8_t packed[FORECAST_MAX_HOURS * FORECAST_PACKED_ENTRY_SIZE] = {0};
+    DataSnapshot data = {0};
+    StepsSnapshot steps = {0};
+
+    forecast_set(time(NULL), packed, sizeof(packed));
+    forecast_save(PERSIST_KEY_FORECAST);
+    CHECK(persist_write_data(PERSIST_KEY_DATA, &data, sizeof(data)) == sizeof(data));
+    CHECK(persist_write_data(PERSIST_KEY_STEPS, &steps, sizeof(steps)) == sizeof(steps));
+}
+
+static void show_weather(int icon, int temp) {
+    s_weather_icon = icon;
+    s_temp = temp;
+    update_weather_icon();
+    update_temp();
+}
+
+static void show_mode(bool steps) {
+    time_t now = time(NULL);
+
+    if (steps) {
+        show_default_mode();
+    } else {
+        show_alt_mode();
+    }
+    display_time_or_steps(localtime(&now));
+}
+
+static void show_texts(void) {
+    show_mode(false);
+}
+
+static void show_steps(void) {
+    s_steps_known = true;
+    s_steps = 88888;
+    show_mode(true);
+}
+
+static void show_alarm(void) {
+    update_alarm("23:59", true);
+}
+
+static void lose_bluetooth(void) {
+    bt_handler(false);
+}
+
+static const struct {
+    const char *name;
+    void (*apply)(void);
+} s_frames[] = {
+    { "texts", show_texts },
+    { "alarm", show_alarm },
+    { "no bluetooth", lose_bluetooth },
+    { "steps", show_steps }
+};
+
+// Every combination of weather icon and texts the face shows, with the
+// other keys at their biggest, must fit the quota and be saved
+static void frames_fit_the_budget(void) {
+    stub_persist_clear();
+    settle();
+    fill_other_keys();
+
+    size_t largest = 0;
+    size_t most_used = 0;
+    for (uint8_t f = 0; f < ARRAY_LENGTH(s_frames); f++) {
+        s_frames[f].apply();
+
+        for (int icon = 0; icon < NUMBER_OF_WEATHER_ICONS; icon++) {
+            show_weather(icon, icon % 2 ? -88 : 88);
+            stub_advance_ms(100);
+
+            uint32_t writes = stub_persist_writes();
+            uint32_t written = stub_persist_bytes_written();
+            save_frame();
+
+            CHECK(stub_persist_writes() > writes);
+            CHECK(frame_snapshot_exists());
+            CHECK(stub_persist_total() <= STUB_PERSIST_QUOTA);
+            largest = MAX(largest, frame_bytes_stored());
+            most_used = MAX(most_used, stub_persist_total());
+
+            printf("  %-12s icon %d: %4u of %u bytes in %u chunks, %u writes of %u bytes\n",
+                    s_frames[f].name, icon, (unsigned int)frame_bytes_stored(), (unsigned int)REGION_SIZE,
+                    chunks_stored(), (unsigned int)(stub_persist_writes() - writes),
+                    (unsigned int)(stub_persist_bytes_written() - written));
+        }
+    }
+
+    printf("  largest frame %u of %u bytes budget, at most %u of %u bytes of storage in use\n",
+            (unsigned int)largest, FRAME_SNAPSHOT_MAX_CHUNKS * PERSIST_DATA_MAX_LENGTH,
+            (unsigned int)most_used, STUB_PERSIST_QUOTA);
+}
+
+// Placeholder of the next launch is the frame saved, decoded once and left
+// in the frame buffer until the real layers are there
+static void placeholder_is_the_saved_frame(void) {
+    stub_persist_clear();
+    settle();
+    show_weather(0, -88);
+    show_alarm();
+    stub_advance_ms(100);
+    save_frame();
+    CHECK(frame_snapshot_exists());
+
+    uint8_t *saved = malloc(REGION_SIZE);
+    memcpy(saved, region(), REGION_SIZE);
+
+    stub_unload_window();
+    memset(region(), 0, REGION_SIZE);
+    size_t heap = heap_bytes_used();
+
+    stub_load_window();
+    stub_render();
+    CHECK(s_frame_snapshot_layer != NULL);
+    CHECK(memcmp(region(), saved, REGION_SIZE) == 0);
+
+    // Not decoded again, whatever is in the frame buffer stays
+    uint8_t poked = saved[0] ^ 0xFF;
+    region()[0] = poked;
+    stub_render();
+    CHECK(region()[0] == poked);
+
+    settle();
+    CHECK(s_frame_snapshot_layer == NULL);
+
+    // Read buffer is gone with the placeholder
+    stub_unload_window();
+    CHECK(heap_bytes_used() == heap);
+    stub_load_window();
+
+    free(saved);
+}
+
+// Frame saved last is not saved again, so every test shows a frame of its own
+static void same_frame_is_not_saved_again(void) {
+    stub_persist_clear();
+    settle();
+    show_weather(2, 55);
+    stub_advance_ms(100);
+    save_frame();
+    CHECK(frame_snapshot_exists());
+
+    uint32_t writes = stub_persist_writes();
+    save_frame();
+    CHECK(stub_persist_writes() == writes);
+
+    show_weather(2, 56);
+    stub_advance_ms(100);
+    save_frame();
+    CHECK(stub_persist_writes() > writes);
+}
+
+// Keys of a bigger frame saved before, by this build or an older one,
+// don't hold the quota once a smaller frame is saved
+static void stale_chunks_are_dropped(void) {
+    uint8_t junk[PERSIST_DATA_MAX_LENGTH] = {0};
+    uint8_t old_header[12] = { 0, 15 };
+
+    stub_persist_clear();
+    for (uint8_t n = 0; n < 15; n++) {
+        persist_write_data(PERSIST_KEY_FRAME_CHUNKS + n, junk, sizeof(junk));
+    }
+    persist_write_data(PERSIST_KEY_FRAME, old_header, sizeof(old_header));
+    CHECK(!frame_snapshot_exists());
+
+    settle();
+    show_weather(3, 42);
+    stub_advance_ms(100);
+    save_frame();
+
+    CHECK(frame_snapshot_exists());
+    CHECK(chunks_stored() < FRAME_SNAPSHOT_MAX_CHUNKS);
+    for (uint8_t n = chunks_stored(); n < 15; n++) {
+        CHECK(!persist_exists(PERSIST_KEY_FRAME_CHUNKS + n));
+    }
+}
+
+// Frame that can't be written leaves nothing behind, not even the old one
+static void full_storage_leaves_no_chunks(void) {
+    uint8_t junk[PERSIST_DATA_MAX_LENGTH] = {0};
+
+    stub_persist_clear();
+    settle();
+    show_weather(4, 11);
+    show_steps();
+    stub_advance_ms(100);
+    save_frame();
+    CHECK(frame_snapshot_exists());
+
+    // All the rest of the quota goes to other keys
+    for (uint32_t key = 100; stub_persist_total() < STUB_PERSIST_QUOTA; key++) {
+        size_t size = MIN(sizeof(junk), STUB_PERSIST_QUOTA - stub_persist_total());
+        CHECK(persist_write_data(key, junk, size) == (int)size);
+    }
+
+    // Texts take more than steps
+    show_texts();
+    show_alarm();
+    stub_advance_ms(100);
+    save_frame();
+
+    CHECK(!frame_snapshot_exists());
+    CHECK(chunks_stored() == 0);
+}
+
+// Chunk buffer of a save is on the heap only while saving
+static void save_keeps_no_heap(void) {
+    stub_persist_clear();
+    settle();
+    show_weather(1, 7);
+    stub_advance_ms(100);
+
+    size_t heap = heap_bytes_used();
+    stub_heap_reset_peak();
+    save_frame();
+
+    CHECK(frame_snapshot_exists());
+    CHECK(heap_bytes_used() == heap);
+    printf("  heap while saving: %u bytes over %u\n",
+            (unsigned int)(stub_heap_peak() - heap), (unsigned int)heap);
+}
+
+static void run_face(void (*test)(void)) {
+    stub_reset();
+    stub_set_rand_step(1);
+    stub_set_event_loop(test);
+    face_main();
+}
+
+int main(void) {
+    run_face(frames_fit_the_budget);
+    run_face(placeholder_is_the_saved_frame);
+    run_face(same_frame_is_not_saved_again);
+    run_face(stale_chunks_are_dropped);
+    run_face(full_storage_leaves_no_chunks);
+    run_face(save_keeps_no_heap);
+    return TEST_RESULT();
+}
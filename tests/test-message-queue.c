@@ -0,0 +1,398 @@
+#include <pebble.h>
+#include "message-queue.h"
+#include "scheduler.h"
+#include "profile.h"
+#include "test.h"
+
+#define CMD_TEST 50
+#define CMD_TEST_BLOB 51
+#define BLOB_LENGTH 700
+
+static uint8_t s_blob[BLOB_LENGTH];
+static uint8_t s_received[BLOB_LENGTH];
+static uint16_t s_received_length = 0;
+static uint8_t s_received_cmd = 0;
+static uint16_t s_handled = 0;
+static uint32_t s_uuid = 1000;
+
+static MqStatus s_status;
+static uint16_t s_completions = 0;
+
+static void message_handler(DictionaryIterator *iterator) {
+    s_handled += 1;
+}
+
+static void completion(MqHandle handle, MqStatus status, uint32_t latency_ms, void *context) {
+    s_status = status;
+    s_completions += 1;
+}
+
+static void blob_handler(uint8_t cmd, const uint8_t *data, uint16_t length, void *context) {
+    s_received_cmd = cmd;
+    s_received_length = length;
+    memcpy(s_received, data, length);
+}
+
+static void setup(void) {
+    for (int i = 0; i < BLOB_LENGTH; i++) {
+        s_blob[i] = i * 7 + i / 256;
+    }
+
+    memset(s_received, 0, sizeof(s_received));
+    s_received_length = 0;
+    s_received_cmd = 0;
+    s_handled = 0;
+    s_completions = 0;
+
+    mq_init(message_handler);
+    mq_set_blob_receiver(s_received, sizeof(s_received), blob_handler, NULL);
+}
+
+static void teardown(void) {
+    mq_deinit();
+    sched_deinit();
+}
+
+static uint32_t tuple_uint(const Tuple *tuple) {
+    switch (tuple->length) {
+        case 1: return tuple->value->uint8;
+        case 2: return tuple->value->uint16;
+        default: return tuple->value->uint32;
+    }
+}
+
+static int32_t outbox_uint(uint32_t key) {
+    DictionaryIterator *iter = stub_outbox();
+    Tuple *tuple = iter ? dict_find(iter, key) : NULL;
+    return tuple ? (int32_t)tuple_uint(tuple) : -1;
+}
+
+// Message from the phone, proto 0 means a legacy peer that doesn't send it
+static void receive(uint8_t cmd, uint8_t proto) {
+    uint8_t buffer[64];
+    DictionaryIterator iter;
+
+    dict_write_begin(&iter, buffer, sizeof(buffer));
+    dict_write_uint8(&iter, MSG_KEY_CMD, cmd);
+    dict_write_uint32(&iter, MSG_KEY_UUID, ++s_uuid);
+    if (proto) {
+        dict_write_uint8(&iter, MSG_KEY_PROTO, proto);
+    }
+
+    CHECK(stub_inbox_receive(buffer, dict_write_end(&iter)));
+}
+
+static void receive_fragment(uint32_t id, uint16_t seq, uint16_t offset, uint16_t length) {
+    uint8_t buffer[PROFILE_INBOX_SIZE];
+    DictionaryIterator iter;
+
+    dict_write_begin(&iter, buffer, sizeof(buffer));
+    dict_write_uint8(&iter, MSG_KEY_CMD, CMD_TEST_BLOB);
+    dict_write_uint32(&iter, MSG_KEY_UUID, ++s_uuid);
+    dict_write_uint8(&iter, MSG_KEY_PROTO, MQ_PROTO_VERSION);
+    dict_write_uint32(&iter, MSG_KEY_FRAG_ID, id);
+    dict_write_uint16(&iter, MSG_KEY_FRAG_SEQ, seq);
+    dict_write_uint16(&iter, MSG_KEY_FRAG_OFFSET, offset);
+    dict_write_uint16(&iter, MSG_KEY_FRAG_TOTAL, BLOB_LENGTH);
+    dict_write_data(&iter, MSG_KEY_FRAG_DATA, s_blob + offset, length);
+
+    CHECK(stub_inbox_receive(buffer, dict_write_end(&iter)));
+}
+
+// Phone takes what is in the outbox, the queue moves on after its gap
+static void deliver(void) {
+    stub_outbox_complete(APP_MSG_OK);
+    stub_advance_ms(1000);
+}
+
+// Peer tells its protocol version, its message is ACKed
+static void handshake(void) {
+    receive(CMD_TEST, MQ_PROTO_VERSION);
+    stub_advance_ms(1000);
+    CHECK(outbox_uint(MSG_KEY_CMD) == MQ_CMD_OUT_ACK);
+    stub_outbox_complete(APP_MSG_OK);
+}
+
+static MqHandle submit_blob(MqPriority priority, uint16_t ttl_secs) {
+    MqRecord record = {
+        .cmd = CMD_TEST_BLOB,
+        .field_count = 1,
+        .fields = {
+            { .key = 60, .type = MQ_FIELD_UINT32, .value = 12345 }
+        }
+    };
+
+    MqOptions options = {
+        .priority = priority,
+        .ttl_secs = ttl_secs,
+        .completion = completion
+    };
+
+    return mq_submit_blob(&record, s_blob, BLOB_LENGTH, &options);
+}
+
+// Copies the fragment in the outbox into s_received, checks its headers
+static void take_fragment(uint16_t seq) {
+    DictionaryIterator *iter = stub_outbox();
+    CHECK(iter != NULL);
+    if (!iter) {
+        return;
+    }
+
+    Tuple *data = dict_find(iter, MSG_KEY_FRAG_DATA);
+    CHECK(data != NULL);
+    CHECK(outbox_uint(MSG_KEY_CMD) == CMD_TEST_BLOB);
+    CHECK(outbox_uint(MSG_KEY_FRAG_SEQ) == seq);
+    CHECK(outbox_uint(MSG_KEY_FRAG_OFFSET) == s_received_length);
+    CHECK(outbox_uint(MSG_KEY_FRAG_TOTAL) == BLOB_LENGTH);
+    if (!data) {
+        return;
+    }
+
+    uint16_t left = BLOB_LENGTH - s_received_length;
+    CHECK(data->length >= MIN(left, MQ_FRAG_MIN_DATA));
+    CHECK(s_received_length + data->length <= BLOB_LENGTH);
+
+    memcpy(s_received + s_received_length, data->value->data, data->length);
+    s_received_length += data->length;
+}
+
+static void test_blob_is_sent_in_fragments(void) {
+    setup();
+    handshake();
+
+    CHECK(submit_blob(MQ_PRIORITY_NORMAL, MQ_DEFAULT_TTL_SECS) != 0);
+
+    uint16_t seq = 0;
+    while (stub_outbox_busy() && seq < BLOB_LENGTH) {
+        take_fragment(seq++);
+        deliver();
+    }
+
+    printf("  %u bytes in %u fragments of a %u byte outbox\n", BLOB_LENGTH, seq, stub_outbox_size());
+    CHECK(seq > 1);
+    CHECK(s_received_length == BLOB_LENGTH);
+    CHECK(memcmp(s_received, s_blob, BLOB_LENGTH) == 0);
+    CHECK(s_completions == 1 && s_status == MQ_STATUS_DELIVERED);
+    CHECK(stub_outbox_overflows() == 0);
+    teardown();
+}
+
+// ACKs ride along, but never squeeze fragment data below MQ_FRAG_MIN_DATA
+static void test_acks_leave_room_for_fragment_data(void) {
+    setup();
+    CHECK(submit_blob(MQ_PRIORITY_NORMAL, MQ_DEFAULT_TTL_SECS) != 0);
+
+    for (int i = 0; i < 8; i++) {
+        receive(CMD_TEST, MQ_PROTO_VERSION);
+    }
+
+    uint16_t acks = 0;
+    uint16_t seq = 0;
+    while (stub_outbox_busy() && seq < BLOB_LENGTH) {
+        Tuple *tuple = dict_find(stub_outbox(), MSG_KEY_ACKS);
+        if (tuple) {
+            acks += tuple->length / sizeof(uint32_t);
+        }
+
+        take_fragment(seq++);
+        deliver();
+    }
+
+    CHECK(acks == 8);
+    CHECK(s_received_length == BLOB_LENGTH);
+    CHECK(memcmp(s_received, s_blob, BLOB_LENGTH) == 0);
+    CHECK(stub_outbox_overflows() == 0);
+    teardown();
+}
+
+static void test_partial_blob_is_not_preempted(void) {
+    setup();
+    handshake();
+
+    submit_blob(MQ_PRIORITY_BULK, MQ_DEFAULT_TTL_SECS);
+    take_fragment(0);
+    stub_outbox_complete(APP_MSG_OK);
+
+    // Between fragments, more urgent message waits for the rest of the blob
+    MqRecord urgent = {
+        .cmd = CMD_TEST
+    };
+    mq_add_record(&urgent, MQ_PRIORITY_CONTROL, 60);
+
+    stub_advance_ms(1000);
+    CHECK(outbox_uint(MSG_KEY_CMD) == CMD_TEST_BLOB);
+    CHECK(outbox_uint(MSG_KEY_FRAG_SEQ) == 1);
+    teardown();
+}
+
+static void test_partial_blob_does_not_expire(void) {
+    setup();
+    handshake();
+
+    submit_blob(MQ_PRIORITY_NORMAL, 2);
+    take_fragment(0);
+    deliver();
+
+    // Next fragment times out and is retried after the TTL ran out
+    CHECK(outbox_uint(MSG_KEY_FRAG_SEQ) == 1);
+    stub_advance_ms(3000);
+    stub_outbox_complete(APP_MSG_SEND_TIMEOUT);
+    stub_advance_ms(5000);
+
+    uint16_t seq = 1;
+    while (stub_outbox_busy() && seq < BLOB_LENGTH) {
+        take_fragment(seq++);
+        deliver();
+    }
+
+    CHECK(s_completions == 1 && s_status == MQ_STATUS_DELIVERED);
+    CHECK(s_received_length == BLOB_LENGTH);
+    teardown();
+}
+
+static void test_partial_blob_is_not_evicted(void) {
+    setup();
+    handshake();
+
+    submit_blob(MQ_PRIORITY_BULK, MQ_DEFAULT_TTL_SECS);
+    take_fragment(0);
+    stub_outbox_complete(APP_MSG_OK);
+
+    // Fills MQ_MAX_BYTES, evictions start at the lowest priority
+    MqRecord record = {
+        .cmd = CMD_TEST
+    };
+    for (int i = 0; i < 100; i++) {
+        mq_add_record(&record, MQ_PRIORITY_NORMAL, 60);
+    }
+
+    MqStats stats;
+    mq_get_stats(&stats);
+    CHECK(stats.dropped > 0);
+    CHECK(s_completions == 0);
+
+    stub_advance_ms(1000);
+    CHECK(outbox_uint(MSG_KEY_FRAG_SEQ) == 1);
+    teardown();
+}
+
+static void test_fragments_are_reassembled(void) {
+    setup();
+
+    uint16_t offset = 0;
+    for (uint16_t seq = 0; offset < BLOB_LENGTH; seq++) {
+        uint16_t length = MIN(BLOB_LENGTH - offset, 150);
+        CHECK(s_received_length == 0);
+        receive_fragment(77, seq, offset, length);
+        offset += length;
+    }
+
+    CHECK(s_received_cmd == CMD_TEST_BLOB);
+    CHECK(s_received_length == BLOB_LENGTH);
+    CHECK(memcmp(s_received, s_blob, BLOB_LENGTH) == 0);
+    CHECK(s_handled == 0);
+    teardown();
+}
+
+static void test_lost_fragment_drops_payload(void) {
+    setup();
+
+    receive_fragment(78, 0, 0, 150);
+    receive_fragment(78, 2, 300, 150);
+    receive_fragment(78, 3, 450, 150);
+    receive_fragment(78, 4, 600, 100);
+    CHECK(s_received_length == 0);
+
+    // Next payload starts clean
+    uint16_t offset = 0;
+    for (uint16_t seq = 0; offset < BLOB_LENGTH; seq++) {
+        uint16_t length = MIN(BLOB_LENGTH - offset, 150);
+        receive_fragment(79, seq, offset, length);
+        offset += length;
+    }
+    CHECK(s_received_length == BLOB_LENGTH);
+    teardown();
+}
+
+static void test_legacy_peer_gets_ack_message(void) {
+    setup();
+    receive(CMD_TEST, 0);
+    CHECK(s_handled == 1);
+
+    stub_advance_ms(1000);
+    CHECK(outbox_uint(MSG_KEY_CMD) == MQ_CMD_OUT_ACK);
+
+    char expected[12];
+    snprintf(expected, sizeof(expected), "%lu", (unsigned long)s_uuid);
+    Tuple *data = dict_find(stub_outbox(), MSG_KEY_DATA);
+    CHECK(data && data->type == TUPLE_CSTRING && strcmp(data->value->cstring, expected) == 0);
+    CHECK(dict_find(stub_outbox(), MSG_KEY_ACKS) == NULL);
+    teardown();
+}
+
+static void test_new_peer_gets_piggybacked_acks(void) {
+    setup();
+    receive(CMD_TEST, MQ_PROTO_VERSION);
+
+    stub_advance_ms(1000);
+    CHECK(outbox_uint(MSG_KEY_CMD) == MQ_CMD_OUT_ACK);
+    CHECK(outbox_uint(MSG_KEY_PROTO) == MQ_PROTO_VERSION);
+
+    Tuple *acks = dict_find(stub_outbox(), MSG_KEY_ACKS);
+    CHECK(acks && acks->length == 4);
+    CHECK(acks && (acks->value->data[0] | acks->value->data[1] << 8 | acks->value->data[2] << 16
+            | (uint32_t)acks->value->data[3] << 24) == s_uuid);
+    teardown();
+}
+
+// Link fails until the queue gives up on what it had, the next message
+// still goes out and finds out that the link is back
+static void test_link_fails_then_comes_back(void) {
+    setup();
+    handshake();
+
+    MqRecord record = {
+        .cmd = CMD_TEST,
+        .field_count = 1,
+        .fields = {
+            { .key = 60, .type = MQ_FIELD_UINT32, .value = 1 }
+        }
+    };
+    MqOptions options = {
+        .priority = MQ_PRIORITY_NORMAL,
+        .ttl_secs = 60,
+        .completion = completion
+    };
+
+    mq_submit(&record, &options);
+    stub_advance_ms(1000);
+    while (stub_outbox_busy()) {
+        stub_outbox_complete(APP_MSG_SEND_TIMEOUT);
+        stub_advance_ms(1000);
+    }
+    CHECK(s_completions == 1 && s_status == MQ_STATUS_FAILED);
+    CHECK(mq_pressure() != MQ_PRESSURE_SATURATED);
+
+    mq_submit(&record, &options);
+    stub_advance_ms(1000);
+    CHECK(outbox_uint(MSG_KEY_CMD) == CMD_TEST);
+    deliver();
+    CHECK(s_completions == 2 && s_status == MQ_STATUS_DELIVERED);
+    CHECK(mq_pressure() == MQ_PRESSURE_NONE);
+    teardown();
+}
+
+int main(void) {
+    RUN(test_blob_is_sent_in_fragments);
+    RUN(test_acks_leave_room_for_fragment_data);
+    RUN(test_partial_blob_is_not_preempted);
+    RUN(test_partial_blob_does_not_expire);
+    RUN(test_partial_blob_is_not_evicted);
+    RUN(test_fragments_are_reassembled);
+    RUN(test_lost_fragment_drops_payload);
+    RUN(test_legacy_peer_gets_ack_message);
+    RUN(test_new_peer_gets_piggybacked_acks);
+    RUN(test_link_fails_then_comes_back);
+    return TEST_RESULT();
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdio.h>
+#include "stub.h"
+
+// Minimal test runner: a failed CHECK is reported and counted,
+// the test keeps going and main() returns the number of failures.
+
+static int s_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        s_failures += 1; \
+        fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+    } \
+} while (0)
+
+#define RUN(test) do { \
+    stub_reset(); \
+    test(); \
+} while (0)
+
+#define TEST_RESULT() (s_failures ? (fprintf(stderr, "%d check(s) failed\n", s_failures), 1) : 0)
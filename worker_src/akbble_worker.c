@@ -0,0 +1,126 @@
+#include <pebble_worker.h>
+#include "../src/snapshot.h"
+
+// Ask the face again if it did not manage to fetch data
+#define FETCH_RETRY_SECS (5 * 60)
+
+static StepsSnapshot s_steps = {0};
+static time_t s_next_fetch_at = 0;
+static time_t s_fetch_due_sent_at = 0;
+
+static void notify_steps() {
+    AppWorkerMessage msg = {
+        .data0 = s_steps.steps & 0xFFFF,
+        .data1 = (s_steps.steps >> 16) & 0xFFFF,
+        .data2 = s_steps.available
+    };
+    app_worker_send_message(WORKER_MSG_STEPS, &msg);
+}
+
+static void update_steps() {
+#if defined(PBL_HEALTH)
+    time_t start = time_start_of_today();
+    time_t end = time(NULL);
+    int32_t steps = 0;
+    bool available = false;
+
+    HealthServiceAccessibilityMask mask = health_service_metric_accessible(HealthMetricStepCount, start, end);
+    if (mask & HealthServiceAccessibilityMaskAvailable) {
+        steps = health_service_sum_today(HealthMetricStepCount);
+        available = true;
+    }
+
+    if (steps == s_steps.steps && start == s_steps.day_start && available == s_steps.available) {
+        return;
+    }
+
+    s_steps.steps = steps;
+    s_steps.day_start = start;
+    s_steps.available = available;
+    persist_write_data(PERSIST_KEY_STEPS, &s_steps, sizeof(s_steps));
+
+    notify_steps();
+#endif
+}
+
+static void check_fetch_due() {
+    time_t now = time(NULL);
+
+    if (now < s_next_fetch_at || now - s_fetch_due_sent_at < FETCH_RETRY_SECS) {
+        return;
+    }
+
+    // Nobody hears this if the face is not running, it asks again when launched
+    s_fetch_due_sent_at = now;
+    AppWorkerMessage msg = {0};
+    app_worker_send_message(WORKER_MSG_FETCH_DUE, &msg);
+}
+
+static void load_next_fetch_at() {
+    DataSnapshot data;
+    if (persist_read_data(PERSIST_KEY_DATA, &data, sizeof(data)) == sizeof(data)) {
+        s_next_fetch_at = data.next_fetch_at;
+    }
+}
+
+#if defined(PBL_HEALTH)
+static void health_handler(HealthEventType event, void *context) {
+    if (event == HealthEventMovementUpdate || event == HealthEventSignificantUpdate) {
+        update_steps();
+    }
+}
+#endif
+
+static void tick_handler(struct tm *tick_time, TimeUnits units_changed) {
+    // Day change resets steps even if there was no movement
+    if (units_changed & DAY_UNIT) {
+        update_steps();
+    }
+
+    check_fetch_due();
+}
+
+static void message_handler(uint16_t type, AppWorkerMessage *data) {
+    switch (type) {
+        case WORKER_MSG_FETCHED:
+            load_next_fetch_at();
+            break;
+
+        case WORKER_MSG_STEPS:
+            // Face just started and wants to be sure it has the latest value
+            notify_steps();
+            break;
+
+        default:
+            break;
+    }
+}
+
+static void worker_init() {
+    persist_read_data(PERSIST_KEY_STEPS, &s_steps, sizeof(s_steps));
+    load_next_fetch_at();
+
+    update_steps();
+
+    app_worker_message_subscribe(message_handler);
+    tick_timer_service_subscribe(MINUTE_UNIT, tick_handler);
+
+#if defined(PBL_HEALTH)
+    health_service_events_subscribe(health_handler, NULL);
+#endif
+}
+
+static void worker_deinit() {
+#if defined(PBL_HEALTH)
+    health_service_events_unsubscribe();
+#endif
+
+    tick_timer_service_unsubscribe();
+    app_worker_message_unsubscribe();
+}
+
+int main(void) {
+    worker_init();
+    worker_event_loop();
+    worker_deinit();
+}